@@ -0,0 +1,52 @@
+#include "Arena.h"
+#include "KeyHash.h"
+#include <algorithm>
+
+static const size_t MAX_BLOCK_BYTES = 1 << 20;
+
+Arena::Arena(size_t blockBytes) {
+	m_blockBytes = std::max<size_t>(blockBytes, 1024);
+	m_block = nullptr;
+	m_used = m_capacity = m_bytes = 0;
+	m_nextBlockBytes = m_blockBytes;
+}
+Arena::~Arena() {
+	reset();
+}
+
+void* Arena::allocateSlow(size_t bytes, size_t alignment) {
+	//something too big to be worth a share of a block gets a block of its own, and the current block stays in use
+	if (bytes > m_nextBlockBytes / 4) {
+		char* own = new char[bytes + alignment];
+		m_blocks.push_back(own);
+		m_bytes += bytes;
+		size_t start = (alignment - reinterpret_cast<size_t>(own) % alignment) % alignment;
+		return own + start;
+	}
+	//blocks double up to MAX_BLOCK_BYTES, so a big crawl doesn't need thousands of them
+	m_block = new char[m_nextBlockBytes];
+	m_blocks.push_back(m_block);
+	m_capacity = m_nextBlockBytes;
+	m_used = 0;
+	m_nextBlockBytes = std::min(m_nextBlockBytes * 2, MAX_BLOCK_BYTES);
+	return allocate(bytes, alignment);
+}
+
+const char* Arena::copy(const char* data, size_t length) {
+	char* p = static_cast<char*>(allocate(length + 1, 1));
+	memcpy(p, data, length);
+	p[length] = '\0';
+	return p;
+}
+
+void Arena::reset() {
+	for (char* block : m_blocks) delete[] block;
+	m_blocks.clear();
+	m_block = nullptr;
+	m_used = m_capacity = m_bytes = 0;
+	m_nextBlockBytes = m_blockBytes;
+}
+
+size_t ArenaStringHash::operator()(const ArenaString& s) const {
+	return (size_t)keyHasher(HASH_WYHASH)(s.data, s.length);
+}
@@ -0,0 +1,75 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//monotonic allocator: memory is carved out of large blocks and only given back all at once, when the Arena is reset or destroyed
+//for short-lived state with lots of small nodes, like everything a crawl keeps, so building it is a pointer bump and freeing it is a few deletes
+class Arena {
+public:
+	explicit Arena(size_t blockBytes = 64 * 1024);
+	~Arena();
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+		size_t start = (m_used + alignment - 1) & ~(alignment - 1);
+		if (start + bytes > m_capacity) return allocateSlow(bytes, alignment);
+		m_used = start + bytes;
+		m_bytes += bytes;
+		return m_block + start;
+	}
+	const char* copy(const char* data, size_t length); //the bytes followed by a '\0'
+	void reset(); //frees every block
+	size_t bytesAllocated() const { return m_bytes; } //handed out since the last reset
+	size_t blockCount() const { return m_blocks.size(); }
+private:
+	void* allocateSlow(size_t bytes, size_t alignment);
+
+	std::vector<char*> m_blocks;
+	char* m_block; //the block being carved up
+	size_t m_used, m_capacity;
+	size_t m_blockBytes, m_nextBlockBytes;
+	size_t m_bytes;
+
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+};
+
+//standard allocator over an Arena, so std containers can keep their nodes in it; deallocate does nothing
+template<typename T>
+struct ArenaAllocator {
+	typedef T value_type;
+	explicit ArenaAllocator(Arena& a) : arena(&a) {}
+	template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+	T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+	void deallocate(T*, size_t) {}
+	Arena* arena;
+};
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+//a string that doesn't own its bytes (usually they're in an Arena); compares like std::string
+struct ArenaString {
+	ArenaString() : data(""), length(0) {}
+	ArenaString(const char* d, size_t n) : data(d), length(n) {}
+	explicit ArenaString(const std::string& s) : data(s.c_str()), length(s.size()) {} //only valid while s is
+	std::string str() const { return std::string(data, length); }
+	int compare(const ArenaString& other) const {
+		int c = memcmp(data, other.data, length < other.length ? length : other.length);
+		if (c != 0) return c;
+		return length < other.length ? -1 : length > other.length ? 1 : 0;
+	}
+	bool operator==(const ArenaString& other) const { return length == other.length && memcmp(data, other.data, length) == 0; }
+	bool operator<(const ArenaString& other) const { return compare(other) < 0; }
+
+	const char* data;
+	size_t length;
+};
+struct ArenaStringHash {
+	size_t operator()(const ArenaString& s) const;
+};
+
+#endif // ARENA_H_
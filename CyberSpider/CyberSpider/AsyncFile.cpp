@@ -0,0 +1,406 @@
+#include "AsyncFile.h"
+#include <algorithm>
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_RW_CUR_POS)
+#define ASYNCFILE_IO_URING
+#endif
+#endif
+#endif
+
+static const unsigned int MAX_THREADS = 64;
+
+AsyncFile::AsyncFile() {
+	m_backend = NONE;
+	m_queueDepth = m_inFlight = m_unsignalled = 0;
+	memset(&m_ring, 0, sizeof(m_ring));
+	m_ring.fd = -1;
+	m_stopping = false;
+}
+AsyncFile::~AsyncFile() {
+	close();
+}
+
+bool AsyncFile::open(unsigned int queueDepth, bool allowIoUring) {
+	close();
+	if (queueDepth == 0) return false;
+	m_queueDepth = queueDepth;
+	m_inFlight = 0;
+	if (allowIoUring && openIoUring(queueDepth)) {
+		m_backend = IO_URING;
+		return true;
+	}
+	startThreads();
+	return true;
+}
+void AsyncFile::startThreads() {
+	//no io_uring: each thread does one blocking read at a time, so queueDepth threads keep up to queueDepth reads in flight
+	m_queueDepth = std::min(m_queueDepth, MAX_THREADS);
+	m_stopping = false;
+	for (unsigned int i = 0; i < m_queueDepth; i++)
+		m_workers.push_back(std::thread(&AsyncFile::worker, this));
+	m_backend = THREAD_POOL;
+}
+bool AsyncFile::open(const std::string& filename, unsigned int queueDepth, bool allowIoUring) {
+	if (!open(queueDepth, allowIoUring)) return false;
+	if (addFile(filename) == -1) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+int AsyncFile::addFile(const std::string& filename) {
+	if (m_backend == NONE) return -1;
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) return -1;
+	std::lock_guard<std::mutex> guard(m_lock); //the pool's threads look files up
+	m_files.push_back(handle);
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1) return -1;
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_files.push_back(fd);
+#endif
+	return int(m_files.size() - 1);
+}
+
+void AsyncFile::close() {
+	if (m_backend == THREAD_POOL) {
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_stopping = true;
+		}
+		m_requestReady.notify_all();
+		for (auto& t : m_workers) t.join();
+		m_workers.clear();
+		m_requests.clear();
+		m_completions.clear();
+	}
+	if (m_backend == IO_URING) closeIoUring();
+#ifdef _WIN32
+	for (void* handle : m_files) CloseHandle(handle);
+#else
+	for (int fd : m_files) ::close(fd);
+#endif
+	m_files.clear();
+	m_backend = NONE;
+	m_queueDepth = m_inFlight = m_unsignalled = 0;
+}
+
+const char* AsyncFile::backendName() const {
+	switch (m_backend) {
+	case IO_URING: return "io_uring";
+	case THREAD_POOL: return "threads";
+	default: return "none";
+	}
+}
+
+bool AsyncFile::submit(const Request& request) {
+	if (m_backend == NONE || m_inFlight >= m_queueDepth || request.file >= m_files.size()) return false;
+	STATS_ADD(m_io.reads, 1); STATS_ADD(m_io.bytesRead, request.length);
+	if (m_backend == IO_URING) return submitIoUring(request);
+	//like the io_uring ring, requests are only handed over (the workers woken) by wait(), so queueing a batch costs no context switches
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_requests.push_back(request);
+	m_inFlight++;
+	m_unsignalled++;
+	return true;
+}
+
+size_t AsyncFile::wait(std::vector<Completion>& completions, size_t minCompletions) {
+	minCompletions = std::min<size_t>(minCompletions, m_inFlight);
+	if (m_backend == IO_URING) return waitIoUring(completions, minCompletions);
+	if (m_backend != THREAD_POOL) return 0;
+	if (m_unsignalled > 1) m_requestReady.notify_all();
+	else if (m_unsignalled == 1) m_requestReady.notify_one();
+	m_unsignalled = 0;
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_completionReady.wait(guard, [&]() { return m_completions.size() >= minCompletions; });
+	size_t n = m_completions.size();
+	completions.insert(completions.end(), m_completions.begin(), m_completions.end());
+	m_completions.clear();
+	m_inFlight -= (unsigned int)n;
+	return n;
+}
+
+void AsyncFile::worker() {
+	std::unique_lock<std::mutex> guard(m_lock);
+	for (;;) {
+		m_requestReady.wait(guard, [&]() { return m_stopping || !m_requests.empty(); });
+		if (m_stopping) return;
+		Request request = m_requests.front();
+		m_requests.pop_front();
+#ifdef _WIN32
+		void* file = m_files[request.file];
+#else
+		int file = m_files[request.file];
+#endif
+		guard.unlock();
+		Completion completion;
+		completion.tag = request.tag;
+		completion.ok = readAt(file, request);
+		guard.lock();
+		m_completions.push_back(completion);
+		m_completionReady.notify_one();
+	}
+}
+
+#ifdef _WIN32
+bool AsyncFile::readAt(void* file, const Request& request) {
+#else
+bool AsyncFile::readAt(int file, const Request& request) {
+#endif
+	//positional reads don't share a file position, so any number of threads can use the same handle
+	if (request.offset < 0) return false;
+#ifdef _WIN32
+	OVERLAPPED position;
+	memset(&position, 0, sizeof(position));
+	position.Offset = (DWORD)request.offset;
+	DWORD read = 0;
+	return ReadFile(file, request.buffer, (DWORD)request.length, &read, &position) && read == request.length;
+#else
+	size_t done = 0;
+	while (done < request.length) {
+		ssize_t n = pread(file, request.buffer + done, request.length - done, off_t(request.offset) + done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		done += n;
+	}
+	return true;
+#endif
+}
+
+bool AsyncFile::evictFromCache(const std::string& filename) {
+#if defined(POSIX_FADV_DONTNEED)
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1) return false;
+	bool ok = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	::close(fd);
+	return ok;
+#else
+	(void)filename;
+	return false;
+#endif
+}
+
+#ifdef ASYNCFILE_IO_URING
+
+//the ring indices are shared with the kernel: read its side with acquire and publish ours with release
+static unsigned loadAcquire(const unsigned* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static void storeRelease(unsigned* p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+bool AsyncFile::openIoUring(unsigned int entries) {
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) return false; //old kernel, seccomp, or io_uring disabled by the administrator
+	m_ring.fd = fd;
+	//IORING_OP_READ (no iovec to keep alive) arrived in the same kernel as this feature bit
+	if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+		closeIoUring();
+		return false;
+	}
+	m_ring.sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_ring.cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single) m_ring.sqRingBytes = m_ring.cqRingBytes = std::max(m_ring.sqRingBytes, m_ring.cqRingBytes);
+	m_ring.sqRing = mmap(0, m_ring.sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (m_ring.sqRing == MAP_FAILED) {
+		m_ring.sqRing = 0;
+		closeIoUring();
+		return false;
+	}
+	if (single) m_ring.cqRing = m_ring.sqRing;
+	else {
+		m_ring.cqRing = mmap(0, m_ring.cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (m_ring.cqRing == MAP_FAILED) {
+			m_ring.cqRing = 0;
+			closeIoUring();
+			return false;
+		}
+	}
+	m_ring.sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+	m_ring.sqes = mmap(0, m_ring.sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (m_ring.sqes == MAP_FAILED) {
+		m_ring.sqes = 0;
+		closeIoUring();
+		return false;
+	}
+	char* sq = static_cast<char*>(m_ring.sqRing);
+	char* cq = static_cast<char*>(m_ring.cqRing);
+	m_ring.sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	m_ring.sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	m_ring.sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	m_ring.sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	m_ring.cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	m_ring.cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	m_ring.cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	m_ring.cqes = cq + params.cq_off.cqes;
+	m_ring.toSubmit = 0;
+	//the kernel rounds entries up to a power of two; never have more reads out than we asked for, so the completion ring can't overflow
+	m_slots.assign(entries, Slot());
+	m_freeSlots.clear();
+	for (unsigned int i = entries; i > 0; i--) m_freeSlots.push_back(i - 1);
+	return true;
+}
+
+void AsyncFile::closeIoUring() {
+	if (m_ring.sqes) munmap(m_ring.sqes, m_ring.sqesBytes);
+	if (m_ring.cqRing && m_ring.cqRing != m_ring.sqRing) munmap(m_ring.cqRing, m_ring.cqRingBytes);
+	if (m_ring.sqRing) munmap(m_ring.sqRing, m_ring.sqRingBytes);
+	if (m_ring.fd != -1) ::close(m_ring.fd); //also cancels anything still in flight
+	memset(&m_ring, 0, sizeof(m_ring));
+	m_ring.fd = -1;
+	m_slots.clear();
+	m_freeSlots.clear();
+}
+
+bool AsyncFile::submitIoUring(const Request& request) {
+	//only queues the read in the ring; wait() hands everything queued to the kernel with one io_uring_enter
+	unsigned int slot = m_freeSlots.back();
+	m_freeSlots.pop_back();
+	m_slots[slot].tag = request.tag;
+	m_slots[slot].length = request.length;
+	unsigned tail = *m_ring.sqTail;
+	unsigned index = tail & *m_ring.sqMask;
+	io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_ring.sqes) + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = m_files[request.file];
+	sqe->off = uint64_t(request.offset);
+	sqe->addr = uint64_t(reinterpret_cast<uintptr_t>(request.buffer));
+	sqe->len = (uint32_t)request.length;
+	sqe->user_data = slot;
+	m_ring.sqArray[index] = index;
+	storeRelease(m_ring.sqTail, tail + 1);
+	m_ring.toSubmit++;
+	m_inFlight++;
+	return true;
+}
+
+size_t AsyncFile::waitIoUring(std::vector<Completion>& completions, size_t minCompletions) {
+	size_t n = 0;
+	for (;;) {
+		unsigned head = *m_ring.cqHead;
+		unsigned tail = loadAcquire(m_ring.cqTail);
+		unsigned int reaped = 0;
+		for (; head != tail; head++, reaped++) {
+			const io_uring_cqe* cqe = static_cast<const io_uring_cqe*>(m_ring.cqes) + (head & *m_ring.cqMask);
+			Slot& slot = m_slots[(size_t)cqe->user_data];
+			Completion completion;
+			completion.tag = slot.tag;
+			completion.ok = cqe->res >= 0 && size_t(cqe->res) == slot.length;
+			completions.push_back(completion);
+			m_freeSlots.push_back((unsigned int)cqe->user_data);
+		}
+		storeRelease(m_ring.cqHead, head);
+		m_inFlight -= reaped;
+		n += reaped;
+		if (n >= minCompletions && m_ring.toSubmit == 0) return n;
+		//submit whatever is queued, and block until enough have completed
+		unsigned flags = n < minCompletions ? IORING_ENTER_GETEVENTS : 0;
+		unsigned wanted = n < minCompletions ? unsigned(minCompletions - n) : 0;
+		int submitted = (int)syscall(__NR_io_uring_enter, m_ring.fd, m_ring.toSubmit, wanted, flags, NULL, 0);
+		if (submitted < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+			return n + failIoUring(completions);
+		}
+		m_ring.toSubmit -= std::min<unsigned>(unsigned(submitted), m_ring.toSubmit);
+	}
+}
+
+size_t AsyncFile::failIoUring(std::vector<Completion>& completions) {
+	//the kernel refused the ring: every read still out comes back failed, so callers waiting for inFlight() to drain don't wait forever,
+	//and the ring makes way for the thread pool. A caller reuses a read's buffer once it's back, and closing the ring doesn't wait for the
+	//kernel to let go of the reads it has, so those are cancelled and waited for first
+	std::vector<bool> busy(m_slots.size(), true);
+	for (size_t i = 0; i < m_freeSlots.size(); i++) busy[m_freeSlots[i]] = false;
+	size_t n = 0;
+	//reads still queued in the submission ring never reached the kernel: take them back out before anything else is submitted
+	unsigned head = loadAcquire(m_ring.sqHead);
+	unsigned tail = *m_ring.sqTail;
+	for (unsigned i = head; i != tail; i++) {
+		const io_uring_sqe* sqe = static_cast<const io_uring_sqe*>(m_ring.sqes) + m_ring.sqArray[i & *m_ring.sqMask];
+		Completion completion;
+		completion.tag = m_slots[(size_t)sqe->user_data].tag;
+		completion.ok = false;
+		completions.push_back(completion);
+		busy[(size_t)sqe->user_data] = false;
+		n++;
+	}
+	tail = head;
+	//the rest are the kernel's: queue a cancel for each (the ring has room, since it holds at most one entry per slot)
+	const uint64_t CANCEL = UINT64_MAX; //user_data of the cancels' own completions
+	size_t outstanding = 0;
+	for (size_t i = 0; i < m_slots.size(); i++) {
+		if (!busy[i]) continue;
+		io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_ring.sqes) + (tail & *m_ring.sqMask);
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = i; //the user_data of the read to cancel
+		sqe->user_data = CANCEL;
+		m_ring.sqArray[tail & *m_ring.sqMask] = tail & *m_ring.sqMask;
+		tail++;
+		outstanding++;
+	}
+	storeRelease(m_ring.sqTail, tail);
+	unsigned toSubmit = unsigned(outstanding);
+	//a read the kernel has completes into the completion ring (cancelled or not) even if io_uring_enter keeps failing, so the ring is polled
+	//if the cancels can't be submitted; each read is reported as it finished, and a cancelled one fails
+	bool entering = true;
+	while (outstanding > 0) {
+		unsigned cqHead = *m_ring.cqHead;
+		unsigned cqTail = loadAcquire(m_ring.cqTail);
+		for (; cqHead != cqTail; cqHead++) {
+			const io_uring_cqe* cqe = static_cast<const io_uring_cqe*>(m_ring.cqes) + (cqHead & *m_ring.cqMask);
+			if (cqe->user_data == CANCEL || !busy[(size_t)cqe->user_data]) continue;
+			Slot& slot = m_slots[(size_t)cqe->user_data];
+			Completion completion;
+			completion.tag = slot.tag;
+			completion.ok = cqe->res >= 0 && size_t(cqe->res) == slot.length;
+			completions.push_back(completion);
+			busy[(size_t)cqe->user_data] = false;
+			outstanding--;
+			n++;
+		}
+		storeRelease(m_ring.cqHead, cqHead);
+		if (outstanding == 0) break;
+		if (!entering) {
+			std::this_thread::yield();
+			continue;
+		}
+		int submitted = (int)syscall(__NR_io_uring_enter, m_ring.fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (submitted >= 0) toSubmit -= std::min<unsigned>(unsigned(submitted), toSubmit);
+		else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) entering = false;
+	}
+	closeIoUring();
+	m_inFlight = 0;
+	startThreads();
+	return n;
+}
+
+#else
+
+bool AsyncFile::openIoUring(unsigned int) { return false; }
+void AsyncFile::closeIoUring() {}
+bool AsyncFile::submitIoUring(const Request&) { return false; }
+size_t AsyncFile::waitIoUring(std::vector<Completion>&, size_t) { return 0; }
+size_t AsyncFile::failIoUring(std::vector<Completion>&) { return 0; }
+
+#endif
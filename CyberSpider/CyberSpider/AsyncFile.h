@@ -0,0 +1,110 @@
+#ifndef ASYNCFILE_H_
+#define ASYNCFILE_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include "BinaryFile.h"
+#include "Stats.h"
+
+//read-only files with many positional reads in flight at once, so a DiskMultiMap can walk several chains while the disk works on all of them
+//reads are queued with submit() and handed back by wait(); on Linux they go through io_uring, anywhere else (or if the kernel refuses
+//io_uring) a pool of threads does blocking positional reads (pread, or ReadFile at an offset on Windows)
+//several files can share one queue (addFile), so a single wait() covers reads on all of them
+//only the thread that opened the AsyncFile may call submit() and wait()
+class AsyncFile {
+public:
+	enum Backend {
+		NONE, //not open
+		IO_URING,
+		THREAD_POOL
+	};
+	struct Request {
+		unsigned int file; //index from addFile (0 for the file given to open)
+		BinaryFile::Offset offset;
+		char* buffer; //must stay valid until the read's Completion comes back
+		size_t length;
+		uint64_t tag; //handed back in the Completion
+	};
+	struct Completion {
+		uint64_t tag;
+		bool ok; //false if the read failed or came back short (eg. past the end of the file)
+	};
+
+	AsyncFile();
+	~AsyncFile();
+	//queueDepth is the most reads that can be in flight (and, for the thread pool, the number of threads)
+	bool open(unsigned int queueDepth, bool allowIoUring = true);
+	bool open(const std::string& filename, unsigned int queueDepth, bool allowIoUring = true); //open, then addFile
+	int addFile(const std::string& filename); //the file's index for Requests, or -1 if it can't be opened
+	void close();
+	bool isOpen() const { return m_backend != NONE; }
+	bool submit(const Request& request); //false if queueDepth reads are already in flight (the request isn't queued)
+	//appends at least min(minCompletions, inFlight()) completions; if io_uring fails outright, every read in flight comes back not ok
+	//and the AsyncFile carries on with the thread pool (whose queueDepth may be smaller)
+	size_t wait(std::vector<Completion>& completions, size_t minCompletions = 1);
+	unsigned int inFlight() const { return m_inFlight; }
+	unsigned int queueDepth() const { return m_queueDepth; }
+	Backend backend() const { return m_backend; }
+	const char* backendName() const;
+	const IoStats& ioStats() const { return m_io; }
+
+	//drops the file's pages from the OS cache so the next reads go to the device (for benchmarks; false where that isn't supported)
+	static bool evictFromCache(const std::string& filename);
+
+private:
+	bool openIoUring(unsigned int entries);
+	void closeIoUring();
+	bool submitIoUring(const Request& request);
+	size_t waitIoUring(std::vector<Completion>& completions, size_t minCompletions);
+	size_t failIoUring(std::vector<Completion>& completions);
+	void startThreads();
+	void worker();
+#ifdef _WIN32
+	bool readAt(void* file, const Request& request);
+#else
+	bool readAt(int file, const Request& request);
+#endif
+
+	Backend m_backend;
+	unsigned int m_queueDepth, m_inFlight;
+	unsigned int m_unsignalled; //thread pool: requests queued since the workers were last woken
+	IoStats m_io;
+#ifdef _WIN32
+	std::vector<void*> m_files; //HANDLEs
+#else
+	std::vector<int> m_files; //file descriptors
+#endif
+
+	//io_uring: the kernel's submission and completion rings, mapped into our memory
+	struct Ring {
+		int fd;
+		void* sqRing; size_t sqRingBytes;
+		void* cqRing; size_t cqRingBytes;
+		void* sqes; size_t sqesBytes;
+		unsigned* sqHead; unsigned* sqTail; unsigned* sqMask; unsigned* sqArray;
+		unsigned* cqHead; unsigned* cqTail; unsigned* cqMask; void* cqes;
+		unsigned toSubmit; //queued in the ring but not yet passed to io_uring_enter
+	} m_ring;
+	struct Slot {
+		uint64_t tag;
+		size_t length;
+	};
+	std::vector<Slot> m_slots;
+	std::vector<unsigned int> m_freeSlots;
+
+	//thread pool
+	std::vector<std::thread> m_workers;
+	std::mutex m_lock;
+	std::condition_variable m_requestReady, m_completionReady;
+	std::deque<Request> m_requests;
+	std::vector<Completion> m_completions;
+	bool m_stopping;
+};
+
+#endif // ASYNCFILE_H_
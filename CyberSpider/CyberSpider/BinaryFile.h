@@ -6,6 +6,8 @@
 #include <string>
 #include <type_traits>
 #include <cstdint> // if Offset is int32_t instead of ios::streamoff
+#include "Stats.h"
+#include "PageVersions.h"
 using namespace std;
 
 template<typename T> struct False : false_type {};
@@ -26,6 +28,8 @@ public:
 
 	typedef int32_t Offset;
 
+	BinaryFile() : m_readOnly(false), m_versions(nullptr), m_versionFile(0), m_snapshot(false), m_generation(0) {}
+
 	~BinaryFile() {
 		m_stream.close();
 	}
@@ -37,6 +41,16 @@ public:
 		return m_stream.good();
 	}
 
+	// Opens a file that another BinaryFile may be writing (eg. for a
+	// snapshot of it): every write through this one fails.
+	bool openReadOnly(const std::string& filename) {
+		if (m_stream.is_open())
+			return false;
+		m_stream.open(filename, ios::in | ios::binary);
+		m_readOnly = m_stream.good();
+		return m_readOnly;
+	}
+
 	bool createNew(const std::string& filename) {
 		if (m_stream.is_open())
 			return false;
@@ -47,6 +61,36 @@ public:
 	void close() {
 		if (m_stream.is_open())
 			m_stream.close();
+		m_readOnly = false;
+		m_versions = nullptr;
+		m_snapshot = false;
+	}
+
+	// With a PageVersions, a written file keeps the bytes its writes
+	// overwrite, and a snapshot of it reads the file as it was at one
+	// generation (see PageVersions.h). Both last until close().
+	void setVersions(PageVersions* versions, unsigned int file) {
+		m_versions = versions;
+		m_versionFile = file;
+		m_snapshot = false;
+	}
+
+	void setSnapshot(PageVersions* versions, unsigned int file, uint32_t generation) {
+		m_versions = versions;
+		m_versionFile = file;
+		m_snapshot = true;
+		m_generation = generation;
+	}
+
+	bool isSnapshot() const {
+		return m_snapshot;
+	}
+
+	// Patches bytes read from fromOffset through another handle (eg. an
+	// AsyncFile) so they are what this snapshot should see.
+	void overlay(char* data, size_t length, Offset fromOffset) const {
+		if (m_snapshot)
+			m_versions->overlay(m_versionFile, m_generation, fromOffset, data, length);
 	}
 
 	template<typename T>
@@ -55,6 +99,11 @@ public:
 	}
 
 	bool write(const char* data, size_t length, Offset toOffset) {
+		if (m_readOnly)
+			return false;
+		STATS_ADD(m_io.writes, 1); STATS_ADD(m_io.seeks, 1); STATS_ADD(m_io.bytesWritten, length);
+		if (m_versions && !m_snapshot)
+			m_versions->beforeWrite(m_versionFile, toOffset, length);
 		return m_stream.seekp(toOffset, ios::beg) &&
 			m_stream.write(data, length);
 	}
@@ -66,10 +115,13 @@ public:
 	}
 
 	bool read(char* data, size_t length, Offset fromOffset)	{
+		STATS_ADD(m_io.reads, 1); STATS_ADD(m_io.seeks, 1); STATS_ADD(m_io.bytesRead, length);
 		bool result = m_stream.seekg(fromOffset, ios::beg) &&
 			m_stream.read(data, length);
 		if (!result)
 			m_stream.clear();
+		else
+			overlay(data, length, fromOffset);
 		return result;
 	}
 
@@ -90,6 +142,7 @@ public:
 	Offset fileLength() {
 		if (!m_stream.is_open())
 			return -1;
+		STATS_ADD(m_io.seeks, 2);
 		ios::streamoff currPos = m_stream.tellg();
 		m_stream.seekg(0, ios::end);
 		ios::streamoff length = m_stream.tellg();
@@ -97,12 +150,26 @@ public:
 		return static_cast<Offset>(length);
 	}
 
+	bool flush() {
+		return static_cast<bool>(m_stream.flush());
+	}
+
 	bool isOpen() const {
 		return m_stream.is_open();
 	}
 
+	const IoStats& ioStats() const {
+		return m_io;
+	}
+
 private:
 	fstream m_stream;
+	IoStats m_io;
+	bool m_readOnly;
+	PageVersions* m_versions;
+	unsigned int m_versionFile;
+	bool m_snapshot;
+	uint32_t m_generation;
 
 	// fstreams are not copyable, so BinaryFiles won't be copyable.
 };
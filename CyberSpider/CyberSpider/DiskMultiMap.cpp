@@ -1,24 +1,54 @@
 #include "DiskMultiMap.h"
 #include "BinaryFile.h"
 #include <cstring>
+#include <cstddef>
+#include <cmath>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DISKMULTIMAP_SSE2
+#endif
 
 DiskMultiMap::Iterator::Iterator() {
 	cached = false;
 	m_offset = -1;
+	m_blockIndex = 0;
 }
 DiskMultiMap::Iterator::Iterator(BinaryFile* file, BinaryFile::Offset offset, const std::string& k) {
 	cached = false;
 	m_offset = offset;
+	m_blockIndex = 0;
 	bf = file;
 	key = k;
 }
 bool DiskMultiMap::Iterator::isValid() const {
 	return m_offset != -1 && bf->isOpen();
 }
+void DiskMultiMap::Iterator::loadBlock() {
+	//one read brings in the whole block, and later values come from m_block until it runs out
+	ValueBlock block;
+	m_block.clear();
+	m_blockNext = -1;
+	if (bf->read(block, blockPointer(m_offset))) {
+		decodeBlock(block, m_block);
+		if (block.next != -1) m_blockNext = blockPointer(block.next);
+	}
+	m_blockIndex = 0;
+	cached = true;
+}
 DiskMultiMap::Iterator& DiskMultiMap::Iterator::operator++() {
 	if (isValid()) {
 		//if the iterator is valid, go to the next one (otherwise it will just return this iterator without changes which isn't valid)
+		if (isBlock(m_offset)) {
+			if (!cached) loadBlock();
+			if (++m_blockIndex < m_block.size()) return *this;
+			m_offset = m_blockNext;
+			cached = false;
+			return *this;
+		}
 		if(!cached) bf->read(m_vct, m_offset);
 		m_offset = m_vct.next;
 		cached = false;
@@ -27,31 +57,69 @@ DiskMultiMap::Iterator& DiskMultiMap::Iterator::operator++() {
 }
 MultiMapTuple DiskMultiMap::Iterator::operator*() {
 	if (!isValid()) return MultiMapTuple(); //if the iterator isn't valid, return an empty multimap
+	if (isBlock(m_offset)) {
+		if (!cached) loadBlock();
+		if (m_blockIndex >= m_block.size()) return MultiMapTuple();
+		MultiMapTuple m;
+		m.key = key;
+		m.value = m_block[m_blockIndex].first;
+		m.context = m_block[m_blockIndex].second;
+		return m;
+	}
 	if (!cached) {
 		bf->read(m_vct, m_offset);
 		cached = true;
 	}
 	return convert(m_vct);
 }
+bool DiskMultiMap::Iterator::matches(const ValueFilter& filter) {
+	if (!isValid()) return false;
+	if (isBlock(m_offset)) {
+		if (!cached) loadBlock();
+		return m_blockIndex < m_block.size() && filter.accepts(m_block[m_blockIndex].first, m_block[m_blockIndex].second);
+	}
+	if (!cached) {
+		bf->read(m_vct, m_offset);
+		cached = true;
+	}
+	return filter.accepts(m_vct.value, strlen(m_vct.value), m_vct.context, strlen(m_vct.context));
+}
 
 DiskMultiMap::DiskMultiMap() {
-	header.numBuckets = 0;
-	header.vct_last_erased = -1;
-	header.kt_last_erased = -1;
+	close();
 }
 DiskMultiMap::~DiskMultiMap() {
 	bf.close();
 }
 
-bool DiskMultiMap::createNew(const std::string& filename, unsigned int numBuckets) {
+bool DiskMultiMap::createNew(const std::string& filename, unsigned int numBuckets, HashFunction hashFunction, Layout layout) {
+	static_assert(sizeof(BucketPage) == PAGE_BYTES, "a BucketPage should be exactly one page");
+	static_assert(sizeof(ValueBlock) == PAGE_BYTES, "a ValueBlock should be exactly one page");
 	close();
+	if (!keyHasher(hashFunction)) return false;
 
 	if (bf.createNew(filename)) {
-		header.numBuckets = numBuckets;
-		if(!bf.write(header, 0)) return false;
+		header.magic = (layout == PAGED) ? PAGED_MAGIC : CHAINED_MAGIC;
+		header.hashFunction = hashFunction;
+		m_hashFunction = hashFunction;
+		m_hasher = keyHasher(hashFunction);
+		if (layout == PAGED) {
+			//pages start on a page boundary, and numBuckets keys fill them to the same load factor as the chained layout
+			header.numBuckets = std::max(1u, (numBuckets + BucketPage::ENTRIES - 1) / BucketPage::ENTRIES);
+			m_bucketsStart = PAGE_BYTES;
+			m_bucketBytes = sizeof(BucketPage);
+		} else header.numBuckets = numBuckets;
+		m_filename = filename;
+		if(!writeHeader()) return false;
 
-		for (int i = 0; i < numBuckets; i++) {
-			if(!bf.write(BinaryFile::Offset(-1), sizeof(DiskHeader) + i*sizeof(BinaryFile::Offset))) return false;
+		for (unsigned int i = 0; i < header.numBuckets; i++) {
+			if (layout == PAGED) {
+				BucketPage page;
+				memset(&page, 0, sizeof(page));
+				page.m_offset = bucketOffset(i); page.overflow = -1;
+				if (!bf.write(page, page.m_offset)) return false;
+			}
+			else if(!bf.write(BinaryFile::Offset(-1), bucketOffset(i))) return false;
 		}
 		return true;
 	}
@@ -60,84 +128,422 @@ bool DiskMultiMap::createNew(const std::string& filename, unsigned int numBucket
 bool DiskMultiMap::openExisting(const std::string& filename) {
 	close();
 
-	if (bf.openExisting(filename)) {
-		if(!bf.read(header, 0)) return false;
+	if (bf.openExisting(filename) && readHeader()) {
+		m_filename = filename;
 		return true;
 	}
 	else return false;
 }
+bool DiskMultiMap::openSnapshot(const DiskMultiMap& source, uint32_t generation) {
+	close();
+	if (source.m_versions == nullptr || source.isSnapshot() || !bf.openReadOnly(source.m_filename)) return false;
+	//the header is read through the snapshot too, so it's the one generation committed, and a file that records it can't be newer
+	//(it can be older: a database opened with shards that disagree only writes the generation it settled on with its first write)
+	bf.setSnapshot(source.m_versions, source.m_versionFile, generation);
+	if (!readHeader() || (hasField(offsetof(DiskHeader, generation)) && header.generation > generation)) {
+		close();
+		return false;
+	}
+	header.generation = generation;
+	m_versions = source.m_versions;
+	m_versionFile = source.m_versionFile;
+	m_filename = source.m_filename;
+	return true;
+}
+bool DiskMultiMap::readHeader() {
+	if(!bf.read(reinterpret_cast<char*>(&header), offsetof(DiskHeader, magic), 0)) return false;
+	uint32_t tail[2];
+	bool hasMagic = bf.read(tail, offsetof(DiskHeader, magic));
+	bool v1 = hasMagic && (tail[0] == CHAINED_MAGIC_V1 || tail[0] == PAGED_MAGIC_V1);
+	bool v2 = hasMagic && (tail[0] == CHAINED_MAGIC_V2 || tail[0] == PAGED_MAGIC_V2);
+	if (v1 || v2 || (hasMagic && (tail[0] == CHAINED_MAGIC || tail[0] == PAGED_MAGIC))) {
+		if (!keyHasher(HashFunction(tail[1]))) return false; //written by a newer version with a hash we don't know
+		header.magic = tail[0];
+		header.hashFunction = tail[1];
+		if (v1) m_headerBytes = offsetof(DiskHeader, blk_last_erased);
+		else if (!bf.read(header.blk_last_erased, offsetof(DiskHeader, blk_last_erased))) return false;
+		if (v2) m_headerBytes = offsetof(DiskHeader, generation);
+		else if (!v1 && !bf.read(header.generation, offsetof(DiskHeader, generation))) return false;
+		m_bucketsStart = m_headerBytes;
+		if (layout() == PAGED) {
+			m_bucketsStart = PAGE_BYTES;
+			m_bucketBytes = sizeof(BucketPage);
+		}
+	} else {
+		//older file: no magic, buckets straight after the free lists, and keys placed with std::hash
+		header.hashFunction = HASH_STD;
+		m_headerBytes = m_bucketsStart = offsetof(DiskHeader, magic);
+	}
+	m_hashFunction = HashFunction(header.hashFunction);
+	m_hasher = keyHasher(m_hashFunction);
+	return true;
+}
 void DiskMultiMap::close() {
 	if(bf.isOpen()) bf.close();
+	m_async.close();
+	m_asyncDepth = 0;
+	m_filename.clear();
 	header.numBuckets = 0;
 	header.vct_last_erased = -1;
 	header.kt_last_erased = -1;
+	header.magic = CHAINED_MAGIC;
+	header.hashFunction = DEFAULT_HASH_FUNCTION;
+	header.blk_last_erased = -1;
+	header.generation = 0;
+	m_versions = nullptr;
+	m_versionFile = 0;
+	m_ktFreedIn = m_vctFreedIn = m_blkFreedIn = 0;
+	m_hashFunction = DEFAULT_HASH_FUNCTION;
+	m_hasher = keyHasher(DEFAULT_HASH_FUNCTION);
+	m_headerBytes = m_bucketsStart = sizeof(DiskHeader);
+	m_bucketBytes = sizeof(BinaryFile::Offset);
 }
-bool DiskMultiMap::insert(const std::string& key, const std::string& value, const std::string& context) {
-	if (!bf.isOpen()) return false;
-	if (key.length() > 120 || value.length() > 120 || context.length() > 120) return false;
-	BinaryFile::Offset vct_offset = -1;
-	if (header.vct_last_erased == -1) {
-		vct_offset = bf.fileLength();
+
+void DiskMultiMap::setVersions(PageVersions* versions) {
+	m_versions = versions;
+	m_versionFile = versions->addFile(&bf);
+	bf.setVersions(versions, m_versionFile);
+}
+bool DiskMultiMap::setGeneration(uint32_t generation, bool write) {
+	header.generation = generation;
+	return !write || !hasField(offsetof(DiskHeader, generation)) || writeHeader();
+}
+bool DiskMultiMap::canReuse(uint32_t freedIn) {
+	//a slot freed after a pinned snapshot's generation is still part of that snapshot; overwriting it would only make the
+	//writer copy its page, so the file grows instead until the snapshot is unpinned
+	if (m_versions == nullptr || m_versions->oldestPinned() >= freedIn) return true;
+	STATS_ADD(m_stats.reuseDeferred, 1);
+	return false;
+}
+
+bool DiskMultiMap::allocateKeyTuple(BinaryFile::Offset& offset) {
+	//look for a reusable position or end of the file
+	if (header.kt_last_erased == -1 || !canReuse(m_ktFreedIn)) {
+		offset = bf.fileLength();
+		STATS_ADD(m_stats.ktAppended, 1);
+		return true;
+	}
+	offset = header.kt_last_erased;
+	STATS_ADD(m_stats.ktReused, 1);
+	return bf.read(header.kt_last_erased, header.kt_last_erased); //reads new last_erased position from the last_erased position
+}
+void DiskMultiMap::freeKeyTuple(BinaryFile::Offset offset) {
+	bf.write(header.kt_last_erased, offset);
+	header.kt_last_erased = offset;
+	m_ktFreedIn = header.generation + 1;
+	STATS_ADD(m_stats.ktFreed, 1);
+}
+bool DiskMultiMap::allocateValue(BinaryFile::Offset& offset, const std::string& value, const std::string& context) {
+	if (header.vct_last_erased == -1 || !canReuse(m_vctFreedIn)) {
+		offset = bf.fileLength();
+		STATS_ADD(m_stats.vctAppended, 1);
 	} else {
-		vct_offset = header.vct_last_erased;
+		offset = header.vct_last_erased;
+		STATS_ADD(m_stats.vctReused, 1);
 		if(!bf.read(header.vct_last_erased, header.vct_last_erased)) return false; //reads new last_erased position from the last_erased position
 	}
 	ValueContextTuple vct;
-	strcpy(vct.value, value.c_str()); strcpy(vct.context, context.c_str()); vct.next = -1; vct.m_offset = vct_offset;
-	if (!bf.write(vct, vct_offset)) return false;
+	strcpy(vct.value, value.c_str()); strcpy(vct.context, context.c_str()); vct.next = -1; vct.m_offset = offset;
+	return bf.write(vct, offset);
+}
+bool DiskMultiMap::addValue(BinaryFile::Offset& head, const std::string& value, const std::string& context) {
+	//pushes to the back of the key's list; head changes if the list was empty or has just been packed into blocks
+	if (head == -1) return allocateValue(head, value, context);
+	if (isBlock(head)) return appendToBlocks(head, value, context);
+
+	BinaryFile::Offset vct_pos = head;
+	ValueContextTuple prev;
+	std::vector<BinaryFile::Offset> nodes;
+	do {
+		if(!bf.read(prev, vct_pos)) return false;
+		nodes.push_back(vct_pos);
+		vct_pos = prev.next;
+	} while (vct_pos != -1);
+	STATS_RECORD(m_stats.insertValueList, nodes.size());
+
+	if (hasField(offsetof(DiskHeader, blk_last_erased)) && nodes.size() + 1 >= BLOCK_THRESHOLD) {
+		//the list has got long: pack it into blocks and give its ValueContextTuples back to the free list
+		//its values are only copied out here, once per list, rather than on every insert that walks it
+		ValueList entries;
+		ValueContextTuple vct;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			if (!bf.read(vct, nodes[i])) return false;
+			entries.push_back(std::make_pair(std::string(vct.value), std::string(vct.context)));
+		}
+		entries.push_back(std::make_pair(value, context));
+		BinaryFile::Offset packed;
+		if (!packBlocks(std::vector<BinaryFile::Offset>(), entries, packed)) return false;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			bf.write(header.vct_last_erased, nodes[i]);
+			header.vct_last_erased = nodes[i];
+			m_vctFreedIn = header.generation + 1;
+			STATS_ADD(m_stats.vctFreed, 1);
+		}
+		head = packed;
+		STATS_ADD(m_stats.listsPacked, 1);
+		return true;
+	}
+	BinaryFile::Offset vct_offset;
+	if (!allocateValue(vct_offset, value, context)) return false;
+	prev.next = vct_offset; //pushing to back of list
+	return bf.write(prev, prev.m_offset);
+}
+int DiskMultiMap::eraseValues(BinaryFile::Offset& head, const std::string& value, const std::string& context) {
+	//erases every node that matches, updating head if the first ones do; erased nodes go on the free list
+	if (isBlock(head)) {
+		//blocks are rewritten with whatever is left, reusing them in order
+		std::vector<BinaryFile::Offset> blocks;
+		ValueList entries, kept;
+		if (!readBlocks(head, blocks, entries)) return 0;
+		for (size_t i = 0; i < entries.size(); i++)
+			if (entries[i].first != value || entries[i].second != context) kept.push_back(entries[i]);
+		int num_deleted = (int)(entries.size() - kept.size());
+		if (num_deleted > 0) packBlocks(blocks, kept, head);
+		return num_deleted;
+	}
+	ValueContextTuple prev, curr;
+	prev.m_offset = -1; //no node kept yet
+	int num_deleted = 0;
+	for (BinaryFile::Offset vct_offset = head; vct_offset != -1; vct_offset = curr.next) {
+		if (!bf.read(curr, vct_offset)) break;
+		if (!strcmp(curr.value, value.c_str()) && !strcmp(curr.context, context.c_str())) {
+			if (prev.m_offset == -1) head = curr.next;
+			else {
+				prev.next = curr.next;
+				bf.write(prev, prev.m_offset);
+			}
+			bf.write(header.vct_last_erased, curr.m_offset);
+			header.vct_last_erased = curr.m_offset;
+			m_vctFreedIn = header.generation + 1;
+			num_deleted++;
+			STATS_ADD(m_stats.vctFreed, 1);
+		} else {
+			prev = curr;
+		}
+	}
+	return num_deleted;
+}
+
+bool DiskMultiMap::allocateBlock(BinaryFile::Offset& offset) {
+	if (header.blk_last_erased == -1 || !canReuse(m_blkFreedIn)) {
+		offset = bf.fileLength();
+		STATS_ADD(m_stats.blocksAppended, 1);
+		return true;
+	}
+	offset = header.blk_last_erased;
+	STATS_ADD(m_stats.blocksReused, 1);
+	return bf.read(header.blk_last_erased, header.blk_last_erased);
+}
+void DiskMultiMap::freeBlock(BinaryFile::Offset offset) {
+	bf.write(header.blk_last_erased, offset); //over next, so m_offset survives for analyze
+	header.blk_last_erased = offset;
+	m_blkFreedIn = header.generation + 1;
+	STATS_ADD(m_stats.blocksFreed, 1);
+}
+
+//each entry is varint(prefix shared with the previous value), varint(suffix length), suffix, varint(context id), where an id equal
+//to the dictionary size adds a context to the dictionary and is followed by varint(length) and the context itself
+static bool putVarint(unsigned char* data, unsigned int& used, unsigned int capacity, size_t v) {
+	do {
+		if (used >= capacity) return false;
+		data[used++] = (unsigned char)((v & 0x7f) | (v >= 0x80 ? 0x80 : 0));
+		v >>= 7;
+	} while (v);
+	return true;
+}
+static bool getVarint(const unsigned char* data, unsigned int& pos, unsigned int used, size_t& v) {
+	v = 0;
+	for (int shift = 0; shift < 32; shift += 7) {
+		if (pos >= used) return false;
+		unsigned char c = data[pos++];
+		v |= (size_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return true;
+	}
+	return false;
+}
+bool DiskMultiMap::encodeValue(ValueBlock& block, std::string& prevValue, std::vector<std::string>& contexts, const std::string& value, const std::string& context) {
+	size_t prefix = 0;
+	while (prefix < prevValue.size() && prefix < value.size() && prevValue[prefix] == value[prefix]) prefix++;
+	size_t id = std::find(contexts.begin(), contexts.end(), context) - contexts.begin();
+	unsigned int used = block.used;
+	const unsigned int capacity = sizeof(block.data);
+	if (!putVarint(block.data, used, capacity, prefix) || !putVarint(block.data, used, capacity, value.size() - prefix)) return false;
+	if (used + value.size() - prefix > capacity) return false;
+	memcpy(block.data + used, value.data() + prefix, value.size() - prefix);
+	used += (unsigned int)(value.size() - prefix);
+	if (!putVarint(block.data, used, capacity, id)) return false;
+	if (id == contexts.size()) {
+		if (!putVarint(block.data, used, capacity, context.size()) || used + context.size() > capacity) return false;
+		memcpy(block.data + used, context.data(), context.size());
+		used += (unsigned int)context.size();
+		contexts.push_back(context);
+	}
+	block.used = (uint16_t)used; //only committed once the whole entry fit
+	block.count++;
+	prevValue = value;
+	return true;
+}
+void DiskMultiMap::decodeBlock(const ValueBlock& block, ValueList& entries, std::string* prevValue, std::vector<std::string>* contexts) {
+	std::string value;
+	std::vector<std::string> dictionary;
+	unsigned int pos = 0, used = std::min<unsigned int>(block.used, sizeof(block.data));
+	for (unsigned int i = 0; i < block.count; i++) {
+		size_t prefix, length, id;
+		if (!getVarint(block.data, pos, used, prefix) || !getVarint(block.data, pos, used, length)) break;
+		if (prefix > value.size() || pos + length > used) break;
+		value = value.substr(0, prefix) + std::string((const char*)block.data + pos, length);
+		pos += (unsigned int)length;
+		if (!getVarint(block.data, pos, used, id) || id > dictionary.size()) break;
+		if (id == dictionary.size()) {
+			if (!getVarint(block.data, pos, used, length) || pos + length > used) break;
+			dictionary.push_back(std::string((const char*)block.data + pos, length));
+			pos += (unsigned int)length;
+		}
+		entries.push_back(std::make_pair(value, dictionary[id]));
+	}
+	if (prevValue) *prevValue = value;
+	if (contexts) contexts->swap(dictionary);
+}
 
-	unsigned int pos = (hash(key) % header.numBuckets);
+bool DiskMultiMap::readBlocks(BinaryFile::Offset head, std::vector<BinaryFile::Offset>& blocks, ValueList& entries) {
+	ValueBlock block;
+	size_t maxBlocks = bf.fileLength() / sizeof(ValueBlock); //stops a damaged chain from looping forever
+	for (BinaryFile::Offset offset = blockPointer(head); offset != -1 && blocks.size() < maxBlocks; offset = block.next) {
+		if (!bf.read(block, offset)) return false;
+		blocks.push_back(offset);
+		decodeBlock(block, entries);
+	}
+	return true;
+}
+bool DiskMultiMap::packBlocks(std::vector<BinaryFile::Offset> blocks, const ValueList& entries, BinaryFile::Offset& head) {
+	//writes entries into the given blocks in order, allocating more if needed and freeing any left over; head is -1 if entries is empty
+	std::vector<ValueBlock> packed;
+	std::string prevValue;
+	std::vector<std::string> contexts;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (packed.empty() || !encodeValue(packed.back(), prevValue, contexts, entries[i].first, entries[i].second)) {
+			packed.push_back(ValueBlock());
+			memset(&packed.back(), 0, sizeof(ValueBlock));
+			prevValue.clear(); contexts.clear();
+			if (!encodeValue(packed.back(), prevValue, contexts, entries[i].first, entries[i].second)) return false;
+		}
+	}
+	while (blocks.size() > packed.size()) {
+		freeBlock(blocks.back());
+		blocks.pop_back();
+	}
+	while (blocks.size() < packed.size()) {
+		BinaryFile::Offset offset;
+		//write each new block straight away so the next one allocated from the end of the file goes after it
+		if (!allocateBlock(offset) || !bf.write(packed[blocks.size()], offset)) return false;
+		blocks.push_back(offset);
+	}
+	for (size_t i = 0; i < packed.size(); i++) {
+		packed[i].m_offset = blocks[i];
+		packed[i].next = (i + 1 < packed.size()) ? blocks[i + 1] : -1;
+		packed[i].last = blocks.back();
+		if (!bf.write(packed[i], blocks[i])) return false;
+	}
+	head = packed.empty() ? -1 : blockPointer(blocks[0]);
+	return true;
+}
+bool DiskMultiMap::appendToBlocks(BinaryFile::Offset head, const std::string& value, const std::string& context) {
+	ValueBlock first, last;
+	if (!bf.read(first, blockPointer(head))) return false;
+	if (first.last == first.m_offset) last = first;
+	else if (!bf.read(last, first.last)) return false;
+	std::string prevValue;
+	std::vector<std::string> contexts;
+	ValueList entries;
+	decodeBlock(last, entries, &prevValue, &contexts);
+	STATS_RECORD(m_stats.insertValueList, entries.size());
+	if (encodeValue(last, prevValue, contexts, value, context)) return bf.write(last, last.m_offset);
+	//the last block is full: start a new one and point both the old last block and the first block at it
+	ValueBlock block;
+	memset(&block, 0, sizeof(block));
+	prevValue.clear(); contexts.clear();
+	if (!encodeValue(block, prevValue, contexts, value, context) || !allocateBlock(block.m_offset)) return false;
+	block.next = -1;
+	block.last = block.m_offset;
+	if (!bf.write(block, block.m_offset)) return false;
+	if (last.m_offset == first.m_offset) {
+		first.next = block.m_offset;
+		first.last = block.m_offset;
+		return bf.write(first, first.m_offset);
+	}
+	last.next = block.m_offset;
+	first.last = block.m_offset;
+	return bf.write(last, last.m_offset) && bf.write(first, first.m_offset);
+}
+
+bool DiskMultiMap::insert(const std::string& key, const std::string& value, const std::string& context) {
+	if (!bf.isOpen() || isSnapshot()) return false;
+	if (key.length() > 120 || value.length() > 120 || context.length() > 120) return false;
+	STATS_ADD(m_stats.inserts, 1);
+	if (layout() == PAGED) {
+		if (!insertPaged(key, value, context)) return false;
+		return writeHeader();
+	}
+
+	unsigned int pos = bucketFor(key);
 	KeyTuple kt; kt.m_offset = -1;
 	BinaryFile::Offset kt_offset = -1;
-	if(!bf.read(kt_offset, sizeof(DiskHeader) + pos*sizeof(BinaryFile::Offset))) return false;
+	if(!bf.read(kt_offset, bucketOffset(pos))) return false;
+	unsigned int chain = 0;
 	if (kt_offset != -1) {
 		//if there is already a KeyTuple at that hash
 		do {
 			if(!bf.read(kt, kt_offset)) return false;
+			chain++;
 		} while (strcmp(kt.key, key.c_str()) && (kt_offset = kt.next) != -1);
 		if (kt_offset != -1) {
 			//that key already exists in the KeyTuple kt
-			BinaryFile::Offset vct_pos = kt.vct_pos;
-			ValueContextTuple prev;
-			do {
-				if(!bf.read(prev, vct_pos)) return false;
-				vct_pos = prev.next;
-			} while (vct_pos != -1);
-			prev.next = vct_offset; //pushing to back of list
-			if (!bf.write(prev, prev.m_offset)) return false;
+			BinaryFile::Offset head = kt.vct_pos;
+			if (!addValue(kt.vct_pos, value, context)) return false;
+			if (kt.vct_pos != head && !bf.write(kt, kt.m_offset)) return false;
 		}
 	}
 	if (kt_offset == -1) {
-		//look for a reusable position or end of the file for kt_offset
-		if (header.kt_last_erased == -1) {
-			kt_offset = bf.fileLength();
-		} else {
-			kt_offset = header.kt_last_erased;
-			if(!bf.read(header.kt_last_erased, header.kt_last_erased)) return false; //reads new last_erased position from the last_erased position
-		}
+		BinaryFile::Offset vct_offset = -1;
+		if (!addValue(vct_offset, value, context) || !allocateKeyTuple(kt_offset)) return false;
 		if (kt.m_offset != -1) {
 			//there is already a KeyTuple at that hash
 			kt.next = kt_offset;
 			if(!bf.write(kt, kt.m_offset)) return false;
 		} else {
 			//there are no KeyTuples at that hash
-			if (!bf.write(kt_offset, sizeof(DiskHeader) + pos*sizeof(BinaryFile::Offset))) return false;
+			if (!bf.write(kt_offset, bucketOffset(pos))) return false;
 		}
 		strcpy(kt.key, key.c_str()); kt.next = -1; kt.vct_pos = vct_offset; kt.m_offset = kt_offset;
 		if(!bf.write(kt, kt_offset)) return false;
 	}
-	if(!bf.write(header, 0)) return false;
+	STATS_RECORD(m_stats.insertChain, chain);
+	if(!writeHeader()) return false;
 	return true;
 }
 
 DiskMultiMap::Iterator DiskMultiMap::search(const std::string& key) {
-	BinaryFile::Offset offset = -1;
-	unsigned int pos = hash(key) % header.numBuckets;
-	bf.read(offset, sizeof(DiskHeader) + pos*sizeof(BinaryFile::Offset));
+	STATS_ADD(m_stats.searches, 1);
 	KeyTuple kt;
-	while(offset != -1 && bf.read(kt, offset) && strcmp(kt.key, key.c_str())) {
+	unsigned int chain = 0;
+	if (layout() == PAGED) {
+		BucketPage page;
+		int index = -1;
+		findPaged(key, m_hasher(key.data(), key.size()), page, index, kt, chain);
+		STATS_RECORD(m_stats.searchChain, chain);
+		if (index == -1) return Iterator();
+		return Iterator(&bf, page.values[index], kt.key);
+	}
+
+	BinaryFile::Offset offset = -1;
+	unsigned int pos = bucketFor(key);
+	bf.read(offset, bucketOffset(pos));
+	while(offset != -1 && bf.read(kt, offset)) {
+		chain++;
+		if (!strcmp(kt.key, key.c_str())) break;
 		offset = kt.next;
 	}
+	STATS_RECORD(m_stats.searchChain, chain);
 	if (offset == -1) return Iterator();
 	else {
 		return Iterator(&bf, kt.vct_pos, kt.key);
@@ -145,9 +551,13 @@ DiskMultiMap::Iterator DiskMultiMap::search(const std::string& key) {
 }
 
 int DiskMultiMap::erase(const std::string& key, const std::string& value, const std::string& context) {
+	if (isSnapshot()) return 0;
+	STATS_ADD(m_stats.erases, 1);
+	if (layout() == PAGED) return erasePaged(key, value, context);
+
 	BinaryFile::Offset offset = -1;
-	unsigned int pos = hash(key) % header.numBuckets;
-	bf.read(offset, sizeof(DiskHeader) + pos*sizeof(BinaryFile::Offset));
+	unsigned int pos = bucketFor(key);
+	bf.read(offset, bucketOffset(pos));
 	KeyTuple kt, prev_kt; prev_kt.m_offset = -1;
 	while (offset != -1) {
 		bf.read(kt, offset);
@@ -156,45 +566,578 @@ int DiskMultiMap::erase(const std::string& key, const std::string& value, const
 		offset = kt.next;
 	}
 	if (offset == -1) return 0;
-	ValueContextTuple prev, curr;
-	BinaryFile::Offset vct_offset = kt.vct_pos;
-	int num_deleted = 0; //number of deleted items to be returned
-	//update kt associated with vct so it keeps pointing to correct head of linked list
-	//this only checks for the nodes that need to be erased from the start of the linked list
-	while (vct_offset != -1 && bf.read(curr, vct_offset) && !strcmp(curr.value, value.c_str()) && !strcmp(curr.context, context.c_str())) {
-		vct_offset = curr.next; kt.vct_pos = vct_offset;
-		bf.write(kt, kt.m_offset);
-		bf.write(header.vct_last_erased, curr.m_offset);
-		header.vct_last_erased = curr.m_offset;
-		num_deleted++;
-	}
-	if (vct_offset == -1) { //ie. all the nodes from start to end match the key, value, and context
+	BinaryFile::Offset head = kt.vct_pos;
+	int num_deleted = eraseValues(kt.vct_pos, value, context); //number of deleted items to be returned
+	if (kt.vct_pos == -1) { //ie. all the nodes from start to end match the key, value, and context
 		//update kt_last_erased and erase this kt
 		if (prev_kt.m_offset != -1) {
 			prev_kt.next = kt.next;
 			bf.write(prev_kt, prev_kt.m_offset);
 		} else {
 			//since prev_kt hasn't been updated, we know kt is at the head of the bucket
-			bf.write(kt.next, sizeof(DiskHeader) + pos*sizeof(BinaryFile::Offset)); //update the bucket pointer
+			bf.write(kt.next, bucketOffset(pos)); //update the bucket pointer
 		}
-		bf.write(header.kt_last_erased, kt.m_offset);
-		header.kt_last_erased = kt.m_offset;
+		freeKeyTuple(kt.m_offset);
+	} else if (kt.vct_pos != head) {
+		//update kt so it keeps pointing to correct head of linked list
+		bf.write(kt, kt.m_offset);
 	}
-	//erase and update remaining nodes of linked list that match
-	while(vct_offset != -1) {
-		bf.read(curr, vct_offset);
-		//check whether curr needs to be deleted
-		if (!strcmp(curr.value, value.c_str()) && !strcmp(curr.context, context.c_str())) {
-			prev.next = curr.next;
+	writeHeader();
+	return num_deleted;
+}
+
+//index of the first of fingerprints[start, count) equal to fingerprint, or count if none are
+static int nextFingerprint(const uint32_t* fingerprints, int start, int count, uint32_t fingerprint) {
+#ifdef DISKMULTIMAP_SSE2
+	__m128i wanted = _mm_set1_epi32((int)fingerprint);
+	for (; start + 4 <= count; start += 4) {
+		__m128i found = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(fingerprints + start)), wanted);
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(found));
+		if (mask) {
+			while (!(mask & 1)) { mask >>= 1; start++; }
+			return start;
+		}
+	}
+#endif
+	for (; start < count; start++)
+		if (fingerprints[start] == fingerprint) return start;
+	return count;
+}
+
+bool DiskMultiMap::findPaged(const std::string& key, uint64_t hash, BucketPage& page, int& index, KeyTuple& kt, unsigned int& keysRead,
+	BinaryFile::Offset* prevPage, BinaryFile::Offset* pageWithRoom) {
+	//returns false only if a read fails; index is the key's entry in page, or -1 with page the bucket's last page
+	//prevPage gets the page before page in the chain (-1 for the bucket's own page), and if the key isn't found pageWithRoom gets the
+	//first page of the chain with a free entry (-1 if they're all full)
+	uint32_t fingerprint = uint32_t(hash >> 32);
+	BinaryFile::Offset pageOffset = bucketOffset((unsigned int)(hash % header.numBuckets));
+	index = -1;
+	keysRead = 0;
+	if (prevPage) *prevPage = -1;
+	if (pageWithRoom) *pageWithRoom = -1;
+	for (;;) {
+		if (!bf.read(page, pageOffset)) return false;
+		STATS_ADD(m_stats.pagesRead, 1);
+		if (pageWithRoom && *pageWithRoom == -1 && page.count < (uint32_t)BucketPage::ENTRIES) *pageWithRoom = pageOffset;
+		int count = std::min<int>(page.count, BucketPage::ENTRIES);
+		for (int i = nextFingerprint(page.fingerprints, 0, count, fingerprint); i < count; i = nextFingerprint(page.fingerprints, i + 1, count, fingerprint)) {
+			if (!bf.read(kt, page.keys[i])) return false;
+			keysRead++;
+			if (!strcmp(kt.key, key.c_str())) {
+				index = i;
+				return true;
+			}
+			STATS_ADD(m_stats.fingerprintCollisions, 1);
+		}
+		if (page.overflow == -1) return true;
+		if (prevPage) *prevPage = pageOffset;
+		pageOffset = page.overflow;
+	}
+}
+
+bool DiskMultiMap::allocatePage(BinaryFile::Offset& offset) {
+	//overflow pages start on a page boundary like the bucket pages, so reading one is a single device page; the free block list is shared
+	//with ValueBlocks (also 4KB), but only a block that is itself aligned (eg. a freed page) is taken
+	if (header.blk_last_erased != -1 && header.blk_last_erased % PAGE_BYTES == 0 && canReuse(m_blkFreedIn)) {
+		offset = header.blk_last_erased;
+		STATS_ADD(m_stats.blocksReused, 1);
+		return bf.read(header.blk_last_erased, header.blk_last_erased);
+	}
+	offset = (bf.fileLength() + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES; //the gap stays zeros, which analyze skips
+	STATS_ADD(m_stats.overflowPages, 1);
+	return true;
+}
+void DiskMultiMap::freePage(BinaryFile::Offset offset) {
+	//rewritten as an empty ValueBlock, so the free list (which links through a block's first bytes) keeps a record analyze recognizes
+	ValueBlock block;
+	memset(&block, 0, sizeof(block));
+	block.next = block.last = -1;
+	block.m_offset = offset;
+	bf.write(block, offset);
+	freeBlock(offset);
+	STATS_ADD(m_stats.overflowFreed, 1);
+}
+
+bool DiskMultiMap::insertPaged(const std::string& key, const std::string& value, const std::string& context) {
+	uint64_t hash = m_hasher(key.data(), key.size());
+	BucketPage page;
+	int index;
+	KeyTuple kt;
+	unsigned int keysRead;
+	BinaryFile::Offset room;
+	if (!findPaged(key, hash, page, index, kt, keysRead, nullptr, &room)) return false;
+	STATS_RECORD(m_stats.insertChain, keysRead);
+	if (index != -1) {
+		BinaryFile::Offset head = page.values[index];
+		if (!addValue(page.values[index], value, context)) return false;
+		return page.values[index] == head || bf.write(page, page.m_offset);
+	}
+	BinaryFile::Offset vct_offset = -1;
+	if (!addValue(vct_offset, value, context)) return false;
+
+	//new key: it goes in the first page of the bucket with room (erases can leave gaps anywhere in the chain), and page is the
+	//bucket's last page, so a new one is chained on if they're all full
+	if (room != -1 && room != page.m_offset) {
+		if (!bf.read(page, room)) return false;
+	} else if (room == -1) {
+		BucketPage next;
+		memset(&next, 0, sizeof(next));
+		if (!allocatePage(next.m_offset)) return false;
+		next.overflow = -1;
+		if (!bf.write(next, next.m_offset)) return false;
+		page.overflow = next.m_offset;
+		if (!bf.write(page, page.m_offset)) return false;
+		page = next;
+	}
+	BinaryFile::Offset kt_offset;
+	if (!allocateKeyTuple(kt_offset)) return false;
+	strcpy(kt.key, key.c_str()); kt.next = -1; kt.vct_pos = vct_offset; kt.m_offset = kt_offset;
+	if (!bf.write(kt, kt_offset)) return false;
+	page.fingerprints[page.count] = uint32_t(hash >> 32);
+	page.keys[page.count] = kt_offset;
+	page.values[page.count] = vct_offset;
+	page.count++;
+	return bf.write(page, page.m_offset);
+}
+
+int DiskMultiMap::erasePaged(const std::string& key, const std::string& value, const std::string& context) {
+	BucketPage page;
+	int index;
+	KeyTuple kt;
+	unsigned int keysRead;
+	BinaryFile::Offset prevPage;
+	if (!findPaged(key, m_hasher(key.data(), key.size()), page, index, kt, keysRead, &prevPage) || index == -1) return 0;
+	BinaryFile::Offset head = page.values[index];
+	int num_deleted = eraseValues(page.values[index], value, context);
+	if (page.values[index] == -1) {
+		//no values left: move the page's last entry into this slot and free the KeyTuple
+		int last = page.count - 1;
+		page.fingerprints[index] = page.fingerprints[last];
+		page.keys[index] = page.keys[last];
+		page.values[index] = page.values[last];
+		page.count--;
+		freeKeyTuple(kt.m_offset);
+		BucketPage prev;
+		if (page.count == 0 && prevPage != -1 && bf.read(prev, prevPage)) {
+			//an emptied overflow page is unlinked and freed, so a bucket's chain shrinks again after purges (its own page always stays)
+			prev.overflow = page.overflow;
 			bf.write(prev, prev.m_offset);
-			bf.write(header.vct_last_erased, curr.m_offset);
-			header.vct_last_erased = curr.m_offset;
-			num_deleted++;
-		} else {
-			prev = curr;
+			freePage(page.m_offset);
 		}
-		vct_offset = curr.next;
+		else bf.write(page, page.m_offset);
+	} else if (page.values[index] != head) {
+		bf.write(page, page.m_offset);
 	}
-	bf.write(header, 0);
+	writeHeader();
 	return num_deleted;
 }
+
+DiskMultiMap::Lookup::Lookup() {
+	map = nullptr;
+	m_state = BUCKET;
+	m_file = m_maxValues = 0;
+	m_index = -1;
+	m_keysRead = m_scanned = 0;
+	m_filter = nullptr;
+	m_failed = false;
+}
+
+template<typename T>
+void DiskMultiMap::Lookup::readInto(T& data, BinaryFile::Offset offset, AsyncFile::Request& request) {
+	request.file = m_file;
+	request.offset = offset;
+	request.buffer = reinterpret_cast<char*>(&data);
+	request.length = sizeof(data);
+	m_read = request;
+}
+
+bool DiskMultiMap::Lookup::start(DiskMultiMap& m, const std::string& k, unsigned int file, unsigned int maxValues, AsyncFile::Request& request, const ValueFilter* filter) {
+	map = &m;
+	key = k;
+	m_file = file;
+	m_maxValues = maxValues;
+	m_filter = filter;
+	m_index = -1;
+	m_keysRead = m_scanned = 0;
+	m_failed = false;
+	m_values.clear();
+	if (!map->bf.isOpen() || maxValues == 0) return false;
+	STATS_ADD(map->m_stats.searches, 1);
+	uint64_t hash = map->m_hasher(key.data(), key.size());
+	BinaryFile::Offset bucket = map->bucketOffset((unsigned int)(hash % map->header.numBuckets));
+	m_fingerprint = uint32_t(hash >> 32);
+	if (map->layout() == PAGED) {
+		m_state = PAGE;
+		readInto(m_page, bucket, request);
+	} else {
+		m_state = BUCKET;
+		readInto(m_bucket, bucket, request);
+	}
+	return true;
+}
+
+bool DiskMultiMap::Lookup::resume(bool ok, AsyncFile::Request& request) {
+	//the read for m_state has landed: use it and set up the next one
+	//this is search() and the Iterator cut into steps, so one key's pointer chase can wait on the disk while others go on
+	if (!ok) {
+		m_failed = true;
+		m_values.clear();
+		return finish();
+	}
+	map->bf.overlay(m_read.buffer, m_read.length, m_read.offset); //on a snapshot, puts back what the writer has changed since
+	switch (m_state) {
+	case BUCKET:
+		if (m_bucket == -1) return finish();
+		m_state = KEY;
+		readInto(m_kt, m_bucket, request);
+		return true;
+	case PAGE:
+		STATS_ADD(map->m_stats.pagesRead, 1);
+		return scanPage(0, request);
+	case KEY:
+		m_keysRead++;
+		if (strcmp(m_kt.key, key.c_str())) {
+			if (map->layout() == CHAINED) {
+				if (m_kt.next == -1) return finish();
+				readInto(m_kt, m_kt.next, request);
+				return true;
+			}
+			STATS_ADD(map->m_stats.fingerprintCollisions, 1);
+			return scanPage(m_index + 1, request);
+		}
+		return readValues(map->layout() == PAGED ? m_page.values[m_index] : m_kt.vct_pos, request);
+	case VALUE: {
+		m_scanned++;
+		if (m_filter == nullptr || m_filter->accepts(m_vct.value, strlen(m_vct.value), m_vct.context, strlen(m_vct.context))) {
+			MultiMapTuple m;
+			m.key = key;
+			m.value = m_vct.value;
+			m.context = m_vct.context;
+			m_values.push_back(m);
+		}
+		return readValues(m_vct.next, request);
+	}
+	case BLOCK: {
+		ValueList entries;
+		decodeBlock(m_block, entries);
+		for (size_t i = 0; i < entries.size() && m_scanned < m_maxValues; i++) {
+			m_scanned++;
+			if (m_filter != nullptr && !m_filter->accepts(entries[i].first, entries[i].second)) continue;
+			MultiMapTuple m;
+			m.key = key;
+			m.value = entries[i].first;
+			m.context = entries[i].second;
+			m_values.push_back(m);
+		}
+		return readValues(m_block.next == -1 ? -1 : blockPointer(m_block.next), request);
+	}
+	}
+	return finish();
+}
+
+bool DiskMultiMap::Lookup::scanPage(int start, AsyncFile::Request& request) {
+	int count = std::min<int>(m_page.count, BucketPage::ENTRIES);
+	m_index = nextFingerprint(m_page.fingerprints, start, count, m_fingerprint);
+	if (m_index < count) {
+		m_state = KEY;
+		readInto(m_kt, m_page.keys[m_index], request);
+		return true;
+	}
+	if (m_page.overflow == -1) return finish();
+	m_state = PAGE;
+	readInto(m_page, m_page.overflow, request);
+	return true;
+}
+
+bool DiskMultiMap::Lookup::readValues(BinaryFile::Offset head, AsyncFile::Request& request) {
+	if (head == -1 || m_scanned >= m_maxValues) return finish();
+	if (isBlock(head)) {
+		m_state = BLOCK;
+		readInto(m_block, blockPointer(head), request);
+	} else {
+		m_state = VALUE;
+		readInto(m_vct, head, request);
+	}
+	return true;
+}
+
+bool DiskMultiMap::Lookup::finish() {
+	STATS_RECORD(map->m_stats.searchChain, m_keysRead);
+	return false;
+}
+
+bool DiskMultiMap::searchBatch(const std::vector<std::string>& keys, std::vector<std::vector<MultiMapTuple> >& results, unsigned int queueDepth) {
+	results.assign(keys.size(), std::vector<MultiMapTuple>());
+	if (!bf.isOpen() || queueDepth == 0) return false;
+	//the reads go through their own handle, so whatever insert and erase left in the fstream's buffer has to reach the file first
+	if (!bf.flush()) return false;
+	if (m_asyncDepth != queueDepth) {
+		if (!m_async.open(m_filename, queueDepth)) return false;
+		m_asyncDepth = queueDepth;
+	}
+	STATS_ADD(m_stats.batches, 1);
+
+	//each Lookup has one read in flight at a time, and takes the next key as soon as its own is done
+	std::vector<Lookup> lookups(std::min<size_t>(m_async.queueDepth(), keys.size()));
+	std::vector<size_t> keyOf(lookups.size());
+	std::vector<AsyncFile::Completion> completions;
+	size_t nextKey = 0;
+	bool ok = true;
+	AsyncFile::Request request;
+	//a read the AsyncFile won't take (eg. its thread pool, after io_uring failed, has fewer threads) fails that key like a failed read
+	auto startNext = [&](size_t slot) {
+		while (nextKey < keys.size()) {
+			keyOf[slot] = nextKey++;
+			if (!lookups[slot].start(*this, keys[keyOf[slot]], 0, UINT_MAX, request)) continue;
+			request.tag = slot;
+			if (m_async.submit(request)) return;
+			lookups[slot].resume(false, request);
+			ok = false;
+		}
+	};
+	for (size_t i = 0; i < lookups.size(); i++) startNext(i);
+	while (m_async.inFlight() > 0) {
+		STATS_RECORD(m_stats.batchInFlight, m_async.inFlight());
+		completions.clear();
+		m_async.wait(completions);
+		for (const auto& completion : completions) {
+			Lookup& lookup = lookups[(size_t)completion.tag];
+			if (lookup.resume(completion.ok, request)) {
+				request.tag = completion.tag;
+				if (m_async.submit(request)) continue;
+				lookup.resume(false, request);
+			}
+			if (lookup.failed()) ok = false;
+			results[keyOf[(size_t)completion.tag]].swap(lookup.values());
+			startNext((size_t)completion.tag);
+		}
+	}
+	return ok;
+}
+
+Stats DiskMultiMap::stats() const {
+	Stats s = m_stats;
+	s.io = bf.ioStats();
+	s.io.merge(m_async.ioStats());
+	return s;
+}
+
+bool DiskMultiMap::analyze(Analysis& result, size_t topValueLists, const KeyVisitor& visitKeys) {
+	if (!bf.isOpen()) return false;
+	BinaryFile::Offset length = bf.fileLength();
+	BinaryFile::Offset dataStart = bucketOffset(header.numBuckets);
+	result.fileBytes = length;
+	result.dataStart = dataStart;
+	result.hashFunction = m_hashFunction;
+	result.layout = layout();
+	result.numBuckets = header.numBuckets;
+	result.overflowPages = result.valueBlocks = result.packedValues = 0;
+	result.usedBuckets = result.liveKeys = result.liveValues = result.deadKeys = result.deadValues = 0;
+	result.deadBytes = 0;
+	result.chainLengths.clear(); result.valueListLengths.clear();
+	result.longestValueLists.clear();
+	result.ok = true;
+
+	//everything is read front to back through a 1MB buffer, so the scan runs at disk bandwidth instead of one seek per record
+	const BinaryFile::Offset CHUNK = 1 << 20;
+	std::vector<char> buf;
+	BinaryFile::Offset bufStart = 0, bufEnd = 0;
+	auto load = [&](BinaryFile::Offset pos, BinaryFile::Offset need) -> const char* {
+		if (pos + need > length) return nullptr;
+		if (pos < bufStart || pos + need > bufEnd) {
+			BinaryFile::Offset len = std::min(std::max(CHUNK, need), length - pos);
+			buf.resize(len);
+			if (!bf.read(buf.data(), len, pos)) return nullptr;
+			bufStart = pos; bufEnd = pos + len;
+		}
+		return &buf[pos - bufStart];
+	};
+
+	//bucket heads for the CHAINED layout; for PAGED, every page, the primary ones first and then overflow pages in file order
+	std::vector<BinaryFile::Offset> heads, pageOffsets;
+	std::vector<BucketPage> pages;
+	for (unsigned int i = 0; i < header.numBuckets; i++) {
+		const char* c = load(bucketOffset(i), m_bucketBytes);
+		if (!c) return false;
+		if (layout() == PAGED) {
+			pages.push_back(BucketPage());
+			memcpy(&pages.back(), c, sizeof(BucketPage));
+			pageOffsets.push_back(bucketOffset(i));
+		} else {
+			heads.push_back(-1);
+			memcpy(&heads.back(), c, sizeof(BinaryFile::Offset));
+		}
+	}
+
+	//records aren't tagged, but every KeyTuple and ValueContextTuple stores its own offset (erased ones too, since only
+	//the first bytes are overwritten by the free list), so a record is recognized by its m_offset matching where it is
+	auto storedOffset = [](const char* c, size_t field) {
+		BinaryFile::Offset offset;
+		memcpy(&offset, c + field, sizeof(offset));
+		return offset;
+	};
+	std::vector<BinaryFile::Offset> ktOffsets, ktNext, ktVct, vctOffsets, vctNext, blkOffsets, blkNext;
+	std::vector<unsigned int> blkCount;
+	std::vector<uint64_t> ktHash; //only for visitKeys, which gets each key's hash without the key being read again
+	BinaryFile::Offset pos = dataStart;
+	uint64_t padding = 0;
+	while (pos < length) {
+		const char* c = load(pos, sizeof(KeyTuple));
+		if (c && storedOffset(c, offsetof(KeyTuple, m_offset)) == pos) {
+			KeyTuple kt;
+			memcpy(&kt, c, sizeof(kt));
+			ktOffsets.push_back(pos); ktNext.push_back(kt.next); ktVct.push_back(kt.vct_pos);
+			if (visitKeys) {
+				kt.key[sizeof(kt.key) - 1] = '\0';
+				ktHash.push_back(m_hasher(kt.key, strlen(kt.key)));
+			}
+			pos += sizeof(KeyTuple);
+			continue;
+		}
+		c = load(pos, sizeof(ValueContextTuple));
+		if (c && storedOffset(c, offsetof(ValueContextTuple, m_offset)) == pos) {
+			ValueContextTuple vct;
+			memcpy(&vct, c, sizeof(vct));
+			vctOffsets.push_back(pos); vctNext.push_back(vct.next);
+			pos += sizeof(ValueContextTuple);
+			continue;
+		}
+		c = load(pos, sizeof(ValueBlock));
+		if (c && storedOffset(c, offsetof(ValueBlock, m_offset)) == pos) {
+			ValueBlock block;
+			memcpy(&block, c, sizeof(block));
+			blkOffsets.push_back(pos); blkNext.push_back(block.next); blkCount.push_back(block.count);
+			pos += sizeof(ValueBlock);
+			continue;
+		}
+		c = (layout() == PAGED) ? load(pos, sizeof(BucketPage)) : nullptr;
+		if (c && storedOffset(c, offsetof(BucketPage, m_offset)) == pos) {
+			pages.push_back(BucketPage());
+			memcpy(&pages.back(), c, sizeof(BucketPage));
+			pageOffsets.push_back(pos);
+			pos += sizeof(BucketPage);
+			result.overflowPages++;
+			continue;
+		}
+		if (layout() == PAGED && pos % PAGE_BYTES != 0) {
+			//overflow pages are aligned, so the file can have zeros up to the next page boundary before one
+			BinaryFile::Offset next = std::min((pos + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES, length);
+			c = load(pos, next - pos);
+			if (c && std::all_of(c, c + (next - pos), [](char b) { return b == 0; })) {
+				padding += next - pos;
+				pos = next;
+				continue;
+			}
+		}
+		result.ok = false; //unrecognized bytes, stop here rather than guess
+		break;
+	}
+
+	//with every record's links in memory (offsets are already sorted), walking the chains costs no I/O
+	auto find = [](const std::vector<BinaryFile::Offset>& offsets, BinaryFile::Offset offset) -> long {
+		std::vector<BinaryFile::Offset>::const_iterator it = std::lower_bound(offsets.begin(), offsets.end(), offset);
+		return (it != offsets.end() && *it == offset) ? (long)(it - offsets.begin()) : -1;
+	};
+	std::vector<bool> ktLive(ktOffsets.size(), false), vctLive(vctOffsets.size(), false), blkLive(blkOffsets.size(), false), pageSeen(pages.size(), false);
+	std::vector<std::pair<unsigned int, long> > lists; //(value list length, KeyTuple index)
+	auto walkKey = [&](long i, BinaryFile::Offset head) {
+		ktLive[i] = true;
+		unsigned int values = 0;
+		long j;
+		if (isBlock(head)) {
+			for (BinaryFile::Offset blk = blockPointer(head); blk != -1 && (j = find(blkOffsets, blk)) != -1 && !blkLive[j]; blk = blkNext[j]) {
+				blkLive[j] = true;
+				values += blkCount[j];
+				result.valueBlocks++;
+			}
+			result.packedValues += values;
+		}
+		else for (BinaryFile::Offset vct = head; vct != -1 && (j = find(vctOffsets, vct)) != -1 && !vctLive[j]; vct = vctNext[j]) {
+			vctLive[j] = true;
+			values++;
+		}
+		result.valueListLengths.add(values);
+		result.liveValues += values;
+		lists.push_back(std::make_pair(values, i));
+		if (visitKeys) visitKeys(ktHash[i], values, ktOffsets[i]);
+	};
+	for (unsigned int b = 0; b < header.numBuckets; b++) {
+		unsigned int chain = 0;
+		long i, p;
+		if (layout() == PAGED) {
+			for (BinaryFile::Offset page = bucketOffset(b); page != -1 && (p = find(pageOffsets, page)) != -1 && !pageSeen[p]; page = pages[p].overflow) {
+				pageSeen[p] = true;
+				int count = std::min<int>(pages[p].count, BucketPage::ENTRIES);
+				for (int e = 0; e < count; e++) {
+					if ((i = find(ktOffsets, pages[p].keys[e])) == -1 || ktLive[i]) continue;
+					walkKey(i, pages[p].values[e]);
+					chain++;
+				}
+			}
+		} else {
+			for (BinaryFile::Offset kt = heads[b]; kt != -1 && (i = find(ktOffsets, kt)) != -1 && !ktLive[i]; kt = ktNext[i]) {
+				walkKey(i, ktVct[i]);
+				chain++;
+			}
+		}
+		result.chainLengths.add(chain);
+		result.liveKeys += chain;
+		if (chain > 0) result.usedBuckets++;
+	}
+	result.deadKeys = (unsigned int)ktOffsets.size() - result.liveKeys;
+	result.deadValues = (unsigned int)vctOffsets.size() - (result.liveValues - result.packedValues); //ValueContextTuples only
+	result.deadBytes = padding + (uint64_t)result.deadKeys*sizeof(KeyTuple) + (uint64_t)result.deadValues*sizeof(ValueContextTuple) +
+		(uint64_t)(blkOffsets.size() - result.valueBlocks)*sizeof(ValueBlock);
+	result.recommendedBuckets = std::max(1u, (unsigned int)(result.liveKeys*(4.0 / 3.0))); //createNew turns this into pages for PAGED
+
+	//only the few longest lists need their keys, so those are the only random reads
+	size_t top = std::min(topValueLists, lists.size());
+	std::partial_sort(lists.begin(), lists.begin() + top, lists.end(),
+		[](const std::pair<unsigned int, long>& a, const std::pair<unsigned int, long>& b) { return a.first > b.first; });
+	for (size_t i = 0; i < top; i++) {
+		std::string key;
+		if (!readKey(ktOffsets[lists[i].second], key)) return false;
+		result.longestValueLists.push_back(std::make_pair(lists[i].first, key));
+	}
+	return true;
+}
+
+bool DiskMultiMap::readKey(BinaryFile::Offset keyTuple, std::string& key) {
+	KeyTuple kt;
+	if (!bf.read(kt, keyTuple)) return false;
+	kt.key[sizeof(kt.key) - 1] = '\0';
+	key = kt.key;
+	return true;
+}
+
+void DiskMultiMap::Analysis::print(std::ostream& out) const {
+	//a page holds BucketPage::ENTRIES keys, so load factor is over key slots while the empty-bucket estimate is over pages
+	double slots = (layout == PAGED) ? (double)numBuckets*BucketPage::ENTRIES : numBuckets;
+	double keysPerBucket = numBuckets ? (double)liveKeys / numBuckets : 0;
+	double loadFactor = slots ? liveKeys / slots : 0;
+	double dataBytes = (double)fileBytes - dataStart;
+	out << "file: " << fileBytes << " bytes" << (ok ? "" : " (scan stopped at an unrecognized record, results are partial)") << std::endl;
+	out << "hash: " << hashName(hashFunction) << (hashFunction == HASH_STD ? " (older file, not portable between compilers)" : "") << std::endl;
+	if (layout == PAGED)
+		out << "layout: paged, " << BucketPage::ENTRIES << " keys per " << PAGE_BYTES << "-byte page, " << overflowPages << " overflow pages" << std::endl;
+	out << "buckets: " << numBuckets << ", " << usedBuckets << " used, load factor " << loadFactor << std::endl;
+	//with a uniform hash a fraction e^-loadFactor of buckets would be empty, so a big gap means the buckets are skewed
+	if (numBuckets)
+		out << "  empty buckets: " << 100.0*(numBuckets - usedBuckets) / numBuckets << "% (uniform hash would give "
+			<< 100.0*std::exp(-keysPerBucket) << "%)" << std::endl;
+	out << "keys: " << liveKeys << " live, " << deadKeys << " dead" << std::endl;
+	out << "values: " << liveValues << " live, " << deadValues << " dead" << std::endl;
+	if (valueBlocks)
+		out << "  " << packedValues << " values packed into " << valueBlocks << " blocks (" << (double)packedValues / valueBlocks << " per block)" << std::endl;
+	out << "dead space: " << deadBytes << " bytes (" << (dataBytes > 0 ? 100.0*deadBytes / dataBytes : 0) << "% of records)" << std::endl;
+	chainLengths.print(out, "key chain length per bucket");
+	valueListLengths.print(out, "value list length per key");
+	out << "longest value lists:" << std::endl;
+	for (size_t i = 0; i < longestValueLists.size(); i++)
+		out << "  " << longestValueLists[i].first << " " << longestValueLists[i].second << std::endl;
+	out << "recommended buckets: " << recommendedBuckets << " (currently " << (unsigned int)slots << ")" << std::endl;
+	if (dataBytes > 0 && deadBytes > dataBytes / 4)
+		out << "more than a quarter of the records are dead: rebuild the database to reclaim the space" << std::endl;
+	else if (loadFactor > 1.5 || (liveKeys > 0 && loadFactor < 0.25))
+		out << "load factor is far from 0.75: rebuild the database with the recommended bucket count" << std::endl;
+}
@@ -4,8 +4,17 @@
 #include <string>
 #include <cstring>
 #include <functional>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <iostream>
 #include "MultiMapTuple.h"
 #include "BinaryFile.h"
+#include "Stats.h"
+#include "KeyHash.h"
+#include "AsyncFile.h"
+#include "PageVersions.h"
+#include "ValueFilter.h"
 
 class DiskMultiMap {
 private:
@@ -17,15 +26,81 @@ private:
 	};
 	struct KeyTuple {
 		char key[128];
-		BinaryFile::Offset vct_pos; //KeyValueContextTuple position
+		BinaryFile::Offset vct_pos; //KeyValueContextTuple position (in the PAGED layout only the page entry's copy is kept up to date)
 		BinaryFile::Offset next;
 		BinaryFile::Offset m_offset;
 	};
 	struct DiskHeader {
 		unsigned int numBuckets;
 		BinaryFile::Offset vct_last_erased, kt_last_erased;
+		//files written before the hash function was recorded stop here, and their bucket array starts at offsetof(DiskHeader, magic)
+		uint32_t magic;
+		uint32_t hashFunction; //a HashFunction
+		//files written before value blocks stop here (the *_MAGIC_V1 numbers) and never pack their lists
+		BinaryFile::Offset blk_last_erased;
+		//files written before snapshots stop here (the *_MAGIC_V2 numbers); their generations are only counted in memory
+		uint32_t generation; //last committed generation (see PageVersions)
 	};
+	//negative as an Offset, so the first bucket of an older file (always -1 or a real offset) can't be mistaken for any of them
+	static const uint32_t CHAINED_MAGIC = 0xD15C4A55;
+	static const uint32_t PAGED_MAGIC = 0xD15C4A52;
+	static const uint32_t CHAINED_MAGIC_V2 = 0xD15C4A54;
+	static const uint32_t PAGED_MAGIC_V2 = 0xD15C4A51;
+	static const uint32_t CHAINED_MAGIC_V1 = 0xD15C4A53;
+	static const uint32_t PAGED_MAGIC_V1 = 0xD15C4A50;
+	//PAGED layout: each bucket is a 4KB page of entries, so a search reads one page and only the KeyTuples whose fingerprint matches
+	struct BucketPage {
+		static const int ENTRIES = 340;
+		BinaryFile::Offset m_offset;
+		BinaryFile::Offset overflow; //next page of this bucket once this one is full, -1 if none
+		uint32_t count;
+		uint32_t unused; //keeps fingerprints 16-byte aligned
+		uint32_t fingerprints[ENTRIES]; //high 32 bits of the key's hash, contiguous so they can be compared four at a time
+		BinaryFile::Offset keys[ENTRIES]; //KeyTuple of each entry
+		BinaryFile::Offset values[ENTRIES]; //head of each entry's ValueContextTuple list
+	};
+	//once a key has BLOCK_THRESHOLD values its list is packed into 4KB blocks, so iterating it costs one read per block instead of per value
+	//entries are (shared prefix with the previous value, rest of the value, context id into the block's dictionary of contexts)
+	struct ValueBlock {
+		BinaryFile::Offset next; //next block of the list, -1 if none (overwritten by the free list when erased)
+		BinaryFile::Offset last; //first block only: the list's last block, so appends don't walk the chain
+		uint16_t count; //entries
+		uint16_t used; //bytes of data in use
+		unsigned char data[4080];
+		BinaryFile::Offset m_offset;
+	};
+	typedef std::vector<std::pair<std::string, std::string> > ValueList; //(value, context)
+	static const unsigned int BLOCK_THRESHOLD = 16;
+	//a value list pointer below -1 points at a ValueBlock instead of a ValueContextTuple; blockPointer converts both ways
+	static bool isBlock(BinaryFile::Offset pointer) { return pointer < -1; }
+	static BinaryFile::Offset blockPointer(BinaryFile::Offset offset) { return -2 - offset; }
+	static bool encodeValue(ValueBlock& block, std::string& prevValue, std::vector<std::string>& contexts, const std::string& value, const std::string& context);
+	static void decodeBlock(const ValueBlock& block, ValueList& entries, std::string* prevValue = nullptr, std::vector<std::string>* contexts = nullptr);
 public:
+	enum Layout {
+		CHAINED, //bucket array of Offsets, each the head of a linked list of KeyTuples
+		PAGED //bucket pages with fingerprints, chained to overflow pages
+	};
+	//result of analyze(): how the keys and values are spread over the buckets and how much of the file is dead
+	struct Analysis {
+		void print(std::ostream& out) const;
+		BinaryFile::Offset fileBytes;
+		BinaryFile::Offset dataStart; //where the records start, after the header and bucket array
+		HashFunction hashFunction;
+		Layout layout;
+		unsigned int numBuckets, usedBuckets; //buckets are pages in the PAGED layout
+		unsigned int overflowPages;
+		unsigned int liveKeys, liveValues; //reachable from the bucket array
+		unsigned int valueBlocks, packedValues; //live ValueBlocks and the values stored in them
+		unsigned int deadKeys, deadValues; //erased (on a free list) or otherwise unreachable; deadValues counts ValueContextTuples, dead blocks are only in deadBytes
+		uint64_t deadBytes;
+		Histogram chainLengths; //KeyTuples per bucket
+		Histogram valueListLengths; //values per key
+		std::vector<std::pair<unsigned int, std::string> > longestValueLists; //(length, key), longest first
+		unsigned int recommendedBuckets; //numBuckets for createNew at a 0.75 load factor, the same ratio IntelWeb::createNew uses
+		bool ok; //false if a record couldn't be recognized, so the numbers only cover the file up to there
+	};
+
 	class Iterator {
 	public:
 		Iterator();
@@ -33,12 +108,17 @@ public:
 		bool isValid() const;
 		Iterator& operator++();
 		MultiMapTuple operator*();
+		bool matches(const ValueFilter& filter); //whether the current value passes filter, checked on the record without building a MultiMapTuple
 	private:
-		BinaryFile::Offset m_offset;
+		BinaryFile::Offset m_offset; //a ValueContextTuple, or a block pointer
 		BinaryFile* bf;
 		std::string key;
 		bool cached;
 		DiskMultiMap::ValueContextTuple m_vct;
+		ValueList m_block; //the current block's values, decoded in one go
+		size_t m_blockIndex;
+		BinaryFile::Offset m_blockNext;
+		void loadBlock();
 		MultiMapTuple convert(ValueContextTuple vct) const {
 			MultiMapTuple m;
 			m.key = std::string(key);
@@ -48,19 +128,118 @@ public:
 		}
 	};
 
+	//one search as a resumable state machine, so many can wait on an AsyncFile at once (searchBatch, and IntelWeb's concurrent crawl)
+	//start() gives the first read to submit, and each time that read completes resume() gives the next one or returns false once the search is done
+	class Lookup {
+	public:
+		Lookup();
+		//file is the map's index in async (see filename()); the search stops after maxValues values
+		//with a filter, values it leaves out still count towards maxValues but aren't kept
+		//false if there is nothing to read (the map isn't open or maxValues is 0)
+		bool start(DiskMultiMap& map, const std::string& key, unsigned int file, unsigned int maxValues, AsyncFile::Request& request, const ValueFilter* filter = nullptr);
+		bool resume(bool ok, AsyncFile::Request& request);
+		bool failed() const { return m_failed; }
+		std::vector<MultiMapTuple>& values() { return m_values; } //the key's values (that passed the filter), empty if it isn't in the map
+		unsigned int scanned() const { return m_scanned; } //values read, including those the filter left out
+	private:
+		enum State { BUCKET, PAGE, KEY, VALUE, BLOCK };
+		bool scanPage(int start, AsyncFile::Request& request);
+		bool readValues(BinaryFile::Offset head, AsyncFile::Request& request);
+		bool finish();
+		template<typename T> void readInto(T& data, BinaryFile::Offset offset, AsyncFile::Request& request);
+
+		DiskMultiMap* map;
+		std::string key;
+		State m_state;
+		unsigned int m_file, m_maxValues;
+		uint32_t m_fingerprint;
+		int m_index; //PAGED: the page entry whose KeyTuple is being read
+		unsigned int m_keysRead;
+		unsigned int m_scanned;
+		const ValueFilter* m_filter;
+		bool m_failed;
+		std::vector<MultiMapTuple> m_values;
+		AsyncFile::Request m_read; //the read in flight
+		//the buffers reads land in
+		BinaryFile::Offset m_bucket;
+		BucketPage m_page;
+		KeyTuple m_kt;
+		ValueContextTuple m_vct;
+		ValueBlock m_block;
+	};
+
 	DiskMultiMap();
 	~DiskMultiMap();
-	bool createNew(const std::string& filename, unsigned int numBuckets);
+	//for the PAGED layout numBuckets is still the number of keys to make room for, and is rounded up to whole pages
+	bool createNew(const std::string& filename, unsigned int numBuckets, HashFunction hashFunction = DEFAULT_HASH_FUNCTION, Layout layout = CHAINED);
 	bool openExisting(const std::string& filename);
+	//opens source's file read-only, as it was at generation (which the caller has pinned in source's PageVersions)
+	//other threads can search the snapshot while source is written; false if source isn't versioned
+	bool openSnapshot(const DiskMultiMap& source, uint32_t generation);
 	void close();
+	//writes copy what they overwrite into versions (see PageVersions), so snapshots of this map can be read while it changes
+	void setVersions(PageVersions* versions);
+	//records a commit in the header; with write false only in memory, and the file gets it with the next write of the header
+	bool setGeneration(uint32_t generation, bool write = true);
+	uint32_t generation() const { return header.generation; }
+	bool isSnapshot() const { return m_versions != nullptr && bf.isSnapshot(); }
 	bool insert(const std::string& key, const std::string& value, const std::string& context);
 	Iterator search(const std::string& key);
 	int erase(const std::string& key, const std::string& value, const std::string& context);
+	Stats stats() const; //counters since this DiskMultiMap was constructed
+	//called by analyze for every live key: the key's hash (with this file's hash function), its number of values, and its KeyTuple for readKey
+	typedef std::function<void(uint64_t keyHash, unsigned int values, BinaryFile::Offset keyTuple)> KeyVisitor;
+	bool analyze(Analysis& result, size_t topValueLists = 10, const KeyVisitor& visitKeys = KeyVisitor()); //reads the whole file sequentially, not by following chains
+	bool readKey(BinaryFile::Offset keyTuple, std::string& key); //the name of a key analyze visited
+	//searches for all the keys at once with up to queueDepth reads in flight, reading each key's whole value list
+	//results[i] gets keys[i]'s values (empty if it isn't in the map); false if any read failed
+	bool searchBatch(const std::vector<std::string>& keys, std::vector<std::vector<MultiMapTuple> >& results, unsigned int queueDepth);
+	const char* asyncBackend() const { return m_async.backendName(); } //what searchBatch's reads go through
+	const std::string& filename() const { return m_filename; } //for AsyncFile::addFile
+	bool flush() { return bf.flush(); } //call before reading through another handle, so inserts and erases have reached the file
+	HashFunction hashFunction() const { return m_hashFunction; }
+	Layout layout() const { return (header.magic == PAGED_MAGIC || header.magic == PAGED_MAGIC_V2 || header.magic == PAGED_MAGIC_V1) ? PAGED : CHAINED; }
 
 private:
+	static const BinaryFile::Offset PAGE_BYTES = 4096;
+
+	BinaryFile::Offset bucketOffset(unsigned int pos) const { return m_bucketsStart + pos*m_bucketBytes; }
+	unsigned int bucketFor(const std::string& key) const { return (unsigned int)(m_hasher(key.data(), key.size()) % header.numBuckets); }
+	bool writeHeader() { return bf.write(reinterpret_cast<const char*>(&header), m_headerBytes, 0); } //only the fields this file has
+	bool readHeader();
+	bool hasField(size_t fieldOffset) const { return m_headerBytes > (BinaryFile::Offset)fieldOffset; }
+	bool canReuse(uint32_t freedIn);
+	bool allocateKeyTuple(BinaryFile::Offset& offset);
+	void freeKeyTuple(BinaryFile::Offset offset);
+	bool allocateValue(BinaryFile::Offset& offset, const std::string& value, const std::string& context);
+	bool addValue(BinaryFile::Offset& head, const std::string& value, const std::string& context);
+	int eraseValues(BinaryFile::Offset& head, const std::string& value, const std::string& context);
+	bool allocateBlock(BinaryFile::Offset& offset);
+	void freeBlock(BinaryFile::Offset offset);
+	bool readBlocks(BinaryFile::Offset head, std::vector<BinaryFile::Offset>& blocks, ValueList& entries);
+	bool packBlocks(std::vector<BinaryFile::Offset> blocks, const ValueList& entries, BinaryFile::Offset& head);
+	bool appendToBlocks(BinaryFile::Offset head, const std::string& value, const std::string& context);
+	bool findPaged(const std::string& key, uint64_t hash, BucketPage& page, int& index, KeyTuple& kt, unsigned int& keysRead,
+		BinaryFile::Offset* prevPage = nullptr, BinaryFile::Offset* pageWithRoom = nullptr);
+	bool allocatePage(BinaryFile::Offset& offset);
+	void freePage(BinaryFile::Offset offset);
+	bool insertPaged(const std::string& key, const std::string& value, const std::string& context);
+	int erasePaged(const std::string& key, const std::string& value, const std::string& context);
+
 	BinaryFile bf;
-	std::hash<std::string> hash;
+	std::string m_filename;
+	AsyncFile m_async; //opened by the first searchBatch
+	unsigned int m_asyncDepth;
 	DiskHeader header;
+	HashFunction m_hashFunction;
+	KeyHasher m_hasher;
+	BinaryFile::Offset m_headerBytes; //how much of DiskHeader this file has
+	BinaryFile::Offset m_bucketsStart;
+	BinaryFile::Offset m_bucketBytes; //size of one bucket: an Offset, or a BucketPage
+	PageVersions* m_versions;
+	unsigned int m_versionFile; //this file's index in m_versions
+	uint32_t m_ktFreedIn, m_vctFreedIn, m_blkFreedIn; //generation each free list was last pushed in
+	Stats m_stats;
 };
 
 #endif // DISKMULTIMAP_H_
\ No newline at end of file
@@ -1,15 +1,23 @@
 #include "IntelWeb.h"
 #include "DiskMultiMap.h"
+#include "LSMMultiMap.h"
 #include "MultiMapTuple.h"
 #include "InteractionTuple.h"
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
-#include <queue>
 #include <set>
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
+#include <climits>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Arena.h"
 
 //operator less than overloaded for InteractionTuple so it can be stored in a set
 bool operator<(const InteractionTuple & lhs, const InteractionTuple & rhs) {
@@ -21,29 +29,278 @@ bool operator<(const InteractionTuple & lhs, const InteractionTuple & rhs) {
 	else return false;
 }
 
-IntelWeb::IntelWeb() {}
+//ingest into a sharded database: the parsing thread hands each insert to the writer thread of the shard its key is in
+//a shard's two files (its share of initiator_events and of target_events) are only written by its thread, so shards take writes at the same time
+//inserts go over in batches, double-buffered: a shard's next batch fills while its writer works through the last one
+class ShardWriters {
+public:
+	ShardWriters(ShardedMultiMap& initiator_events, ShardedMultiMap& target_events);
+	~ShardWriters(); //stops the threads once they finish the batch they're on
+	bool insertEvent(const std::string& initiator, const std::string& target, const std::string& context); //false if the shard's writer has failed
+	bool drain(); //hands over every partial batch and waits for all of them to be written; false if any insert failed
+
+private:
+	static const size_t BATCH_INSERTS = 256;
+	struct Insert {
+		bool target; //into target_events (key target, value initiator) rather than initiator_events
+		std::string key, value, context;
+	};
+	struct Shard {
+		std::thread thread;
+		std::mutex lock;
+		std::condition_variable ready, done;
+		std::vector<Insert> filling, queued; //each BATCH_INSERTS long, reused so their strings keep their buffers
+		size_t filled, numQueued;
+		bool busy, failed, stop; //busy while the writer has queued
+	};
+	Insert& next(unsigned int shard);
+	bool handOver(Shard& s);
+	void write(unsigned int shard);
+
+	ShardedMultiMap& m_initiators;
+	ShardedMultiMap& m_targets;
+	std::vector<std::unique_ptr<Shard> > m_shards;
+};
+
+ShardWriters::ShardWriters(ShardedMultiMap& initiator_events, ShardedMultiMap& target_events) : m_initiators(initiator_events), m_targets(target_events) {
+	for (unsigned int i = 0; i < initiator_events.shards(); i++) {
+		m_shards.push_back(std::unique_ptr<Shard>(new Shard));
+		Shard& s = *m_shards.back();
+		s.filling.resize(BATCH_INSERTS);
+		s.queued.resize(BATCH_INSERTS);
+		s.filled = s.numQueued = 0;
+		s.busy = s.failed = s.stop = false;
+	}
+	for (unsigned int i = 0; i < m_shards.size(); i++) m_shards[i]->thread = std::thread(&ShardWriters::write, this, i);
+}
+ShardWriters::~ShardWriters() {
+	for (size_t i = 0; i < m_shards.size(); i++) {
+		{
+			std::lock_guard<std::mutex> guard(m_shards[i]->lock);
+			m_shards[i]->stop = true;
+		}
+		m_shards[i]->ready.notify_one();
+		m_shards[i]->thread.join();
+	}
+}
+ShardWriters::Insert& ShardWriters::next(unsigned int shard) {
+	Shard& s = *m_shards[shard];
+	return s.filling[s.filled++];
+}
+bool ShardWriters::insertEvent(const std::string& initiator, const std::string& target, const std::string& context) {
+	unsigned int shards[2] = { m_initiators.shardOf(initiator), m_targets.shardOf(target) };
+	Insert& i = next(shards[0]);
+	i.target = false;
+	i.key.assign(initiator);
+	i.value.assign(target);
+	i.context.assign(context);
+	Insert& t = next(shards[1]);
+	t.target = true;
+	t.key.assign(target);
+	t.value.assign(initiator);
+	t.context.assign(context);
+	bool ok = true;
+	for (unsigned int k = 0; k < 2; k++) {
+		Shard& s = *m_shards[shards[k]];
+		//both inserts can land in one shard, so a batch is handed over with room for another event's pair
+		if (s.filled + 2 > BATCH_INSERTS) ok = handOver(s) && ok;
+	}
+	return ok;
+}
+bool ShardWriters::handOver(Shard& s) {
+	std::unique_lock<std::mutex> lock(s.lock);
+	s.done.wait(lock, [&s]() { return !s.busy; });
+	if (s.filled > 0) {
+		s.filling.swap(s.queued);
+		s.numQueued = s.filled;
+		s.filled = 0;
+		s.busy = true;
+		s.ready.notify_one();
+	}
+	return !s.failed;
+}
+bool ShardWriters::drain() {
+	bool ok = true;
+	for (size_t i = 0; i < m_shards.size(); i++) ok = handOver(*m_shards[i]) && ok;
+	for (size_t i = 0; i < m_shards.size(); i++) {
+		Shard& s = *m_shards[i];
+		std::unique_lock<std::mutex> lock(s.lock);
+		s.done.wait(lock, [&s]() { return !s.busy; });
+		ok = !s.failed && ok;
+	}
+	return ok;
+}
+void ShardWriters::write(unsigned int shard) {
+	Shard& s = *m_shards[shard];
+	DiskMultiMap& initiators = m_initiators.shard(shard);
+	DiskMultiMap& targets = m_targets.shard(shard);
+	std::unique_lock<std::mutex> lock(s.lock);
+	for (;;) {
+		s.ready.wait(lock, [&s]() { return s.busy || s.stop; });
+		if (!s.busy) return;
+		lock.unlock();
+		bool ok = true;
+		for (size_t i = 0; i < s.numQueued; i++) {
+			const Insert& insert = s.queued[i];
+			ok = (insert.target ? targets : initiators).insert(insert.key, insert.value, insert.context) && ok;
+		}
+		lock.lock();
+		if (!ok) s.failed = true;
+		s.busy = false;
+		s.done.notify_one();
+	}
+}
+
+IntelWeb::IntelWeb() {
+	m_engine = HASH;
+	m_asyncConcurrency = 0;
+	m_snapshotOf = nullptr;
+	m_snapshotGeneration = 0;
+	m_writers = nullptr;
+}
 IntelWeb::~IntelWeb() {
 	close();
 }
-bool IntelWeb::createNew(const std::string& filePrefix, unsigned int maxDataItems) {
+bool IntelWeb::createNew(const std::string& filePrefix, unsigned int maxDataItems, Engine engine, HashFunction hashFunction, const std::vector<std::string>& shardPrefixes) {
 	close();
-	bool success = initiator_events.createNew(filePrefix + "-initiator.dmm", (unsigned int) maxDataItems*(4.0 / 3.0)) && 
-		target_events.createNew(filePrefix + "-target.dmm", (unsigned int)maxDataItems*(4.0 / 3.0));
+	m_engine = engine;
+	bool success;
+	if (engine == LSM) {
+		//maxDataItems doesn't size anything for the LSM engine since runs grow as needed
+		success = shardPrefixes.empty() && lsm_initiator_events.createNew(filePrefix + "-initiator.lsm", LSM_MEMTABLE_ENTRIES) &&
+			lsm_target_events.createNew(filePrefix + "-target.lsm", LSM_MEMTABLE_ENTRIES);
+	} else {
+		//the manifest is written first, and a database that isn't sharded removes any left from an earlier one, so openExisting finds these files
+		std::vector<std::string> prefixes = shardPrefixes.empty() ? std::vector<std::string>(1, filePrefix) : shardPrefixes;
+		std::string manifest = filePrefix + ".shards";
+		if (shardPrefixes.empty()) {
+			std::remove(manifest.c_str());
+			success = true;
+		} else {
+			std::ofstream outf(manifest);
+			for (size_t i = 0; i < prefixes.size(); i++) outf << prefixes[i] << '\n';
+			success = outf.good();
+		}
+		std::vector<std::string> initiatorFiles, targetFiles;
+		for (size_t i = 0; i < prefixes.size(); i++) {
+			initiatorFiles.push_back(prefixes[i] + "-initiator.dmm");
+			targetFiles.push_back(prefixes[i] + "-target.dmm");
+		}
+		DiskMultiMap::Layout layout = (engine == PAGED) ? DiskMultiMap::PAGED : DiskMultiMap::CHAINED;
+		unsigned int buckets = (unsigned int)(maxDataItems*(4.0 / 3.0) / prefixes.size()) + 1;
+		//flushed so snapshots, which read through their own handles, find the new files whole
+		success = success && initiator_events.createNew(initiatorFiles, buckets, hashFunction, layout) &&
+			target_events.createNew(targetFiles, buckets, hashFunction, layout) && initiator_events.flush() && target_events.flush();
+		if (success) startVersions();
+	}
 	if (!success) close();
 	return success;
 }
+std::vector<std::string> IntelWeb::shardPrefixes(const std::string& filePrefix) {
+	std::vector<std::string> prefixes;
+	std::ifstream inf(filePrefix + ".shards");
+	std::string line;
+	while (inf && getline(inf, line))
+		if (!line.empty()) prefixes.push_back(line);
+	if (prefixes.empty()) prefixes.push_back(filePrefix);
+	return prefixes;
+}
 bool IntelWeb::openExisting(const std::string& filePrefix) {
 	close();
-	bool success = initiator_events.openExisting(filePrefix + "-initiator.dmm") && target_events.openExisting(filePrefix + "-target.dmm");
+	//the engine isn't passed in, so it is picked by whichever pair of files exists
+	m_engine = HASH;
+	std::vector<std::string> prefixes = shardPrefixes(filePrefix), initiatorFiles, targetFiles;
+	for (size_t i = 0; i < prefixes.size(); i++) {
+		initiatorFiles.push_back(prefixes[i] + "-initiator.dmm");
+		targetFiles.push_back(prefixes[i] + "-target.dmm");
+	}
+	bool success = initiator_events.openExisting(initiatorFiles) && target_events.openExisting(targetFiles) &&
+		initiator_events.hashFunction() == target_events.hashFunction();
+	if (success && initiator_events.layout() == DiskMultiMap::PAGED)
+		m_engine = PAGED;
+	if (success) startVersions();
+	if (!success) {
+		close();
+		m_engine = LSM;
+		success = lsm_initiator_events.openExisting(filePrefix + "-initiator.lsm") && lsm_target_events.openExisting(filePrefix + "-target.lsm");
+	}
+	if (!success) close();
+	return success;
+}
+bool IntelWeb::openSnapshot(IntelWeb& live) {
+	close();
+	if (live.m_engine == LSM || live.m_snapshotOf != nullptr || !live.initiator_events.isOpen()) return false;
+	m_engine = live.m_engine;
+	m_snapshotGeneration = live.m_versions.pin();
+	m_snapshotOf = &live.m_versions;
+	bool success = initiator_events.openSnapshot(live.initiator_events, m_snapshotGeneration) &&
+		target_events.openSnapshot(live.target_events, m_snapshotGeneration);
 	if (!success) close();
 	return success;
 }
 void IntelWeb::close() {
+	m_async.close();
+	m_asyncConcurrency = 0;
 	initiator_events.close();
 	target_events.close();
+	lsm_initiator_events.close();
+	lsm_target_events.close();
+	if (m_snapshotOf != nullptr) m_snapshotOf->unpin(m_snapshotGeneration);
+	m_snapshotOf = nullptr;
+	m_versions.reset(0);
+}
+
+void IntelWeb::startVersions() {
+	//every shard of both maps counts the same generations, so a snapshot pins one number for all of them; what's on disk now is that generation
+	//it's only set in memory, so opening a database to crawl, analyze or report on it doesn't write to it; each file's header takes it with
+	//the file's first insert or erase
+	uint32_t generation = std::max(initiator_events.generation(), target_events.generation());
+	initiator_events.setGeneration(generation, false);
+	target_events.setGeneration(generation, false);
+	m_versions.reset(generation);
+	initiator_events.setVersions(&m_versions);
+	target_events.setVersions(&m_versions);
+}
+bool IntelWeb::commit() {
+	if (m_engine == LSM) return true;
+	//the shards' writers have to be idle while the files are flushed, and everything before the commit has to be in it
+	//drain waits for every writer even if one failed, and the generation is committed either way: what was written is in the files, and a
+	//snapshot that pins meanwhile waits for the generation to close
+	bool drained = m_writers == nullptr || m_writers->drain();
+	uint32_t generation = m_versions.generation() + 1;
+	bool ok = initiator_events.setGeneration(generation) && target_events.setGeneration(generation);
+	return m_versions.commit() && ok && drained;
+}
+uint32_t IntelWeb::generation() const {
+	return m_snapshotOf != nullptr ? m_snapshotGeneration : m_versions.generation();
+}
+
+bool IntelWeb::insertEvent(const std::string& initiator, const std::string& target, const std::string& context) {
+	if (m_engine == LSM) return lsm_initiator_events.insert(initiator, target, context) && lsm_target_events.insert(target, initiator, context);
+	if (m_writers != nullptr) return m_writers->insertEvent(initiator, target, context);
+	return initiator_events.insert(initiator, target, context) && target_events.insert(target, initiator, context);
 }
 
 bool IntelWeb::ingest(const std::string& telemetryFile) {
+	if (m_snapshotOf != nullptr) return false;
+	bool binary = TelemetryFile::isBinary(telemetryFile);
+	std::unique_ptr<ShardWriters> writers;
+	if (shards() > 1) {
+		writers.reset(new ShardWriters(initiator_events, target_events));
+		m_writers = writers.get();
+	}
+	bool success = binary ? ingestBinary(telemetryFile) : ingestText(telemetryFile); //both end with a commit, which drains any writers
+	//one that fails partway has still written the events before the failure, so they're committed too, or a snapshot would wait forever
+	//for their generation; one that wrote nothing (eg. its file wouldn't open) commits nothing
+	if (!success) {
+		if (m_writers != nullptr) m_writers->drain();
+		if (m_versions.written()) commit();
+	}
+	m_writers = nullptr;
+	return success;
+}
+
+bool IntelWeb::ingestText(const std::string& telemetryFile) {
 	// Open the file for input
 	std::ifstream inf(telemetryFile);
 	// Test for failure to open
@@ -53,6 +310,7 @@ bool IntelWeb::ingest(const std::string& telemetryFile) {
 	}
 
 	std::string line;
+	unsigned int events = 0;
 	while (getline(inf, line)) {
 		std::istringstream iss(line);
 		std::string context, initiator, target;
@@ -66,100 +324,429 @@ bool IntelWeb::ingest(const std::string& telemetryFile) {
 		if (iss >> dummy) // succeeds if there a non-whitespace char
 			std::cerr << "Ignoring extra data in line: " << line << std::endl;
 
-		if(!initiator_events.insert(initiator, target, context)) return false;
-		if(!target_events.insert(target, initiator, context)) return false;
+		if(!insertEvent(initiator, target, context)) return false;
+		if (++events % COMMIT_EVENTS == 0 && m_versions.hasReaders() && !commit()) return false;
+	}
+	return commit();
+}
+
+//the binary format has nothing to tokenize: each block's names are copied out once, and its events are inserted straight from the id columns
+bool IntelWeb::ingestBinary(const std::string& telemetryFile) {
+	TelemetryFile::Reader reader;
+	if (!reader.open(telemetryFile)) {
+		std::cerr << "Cannot open telemetry file!" << std::endl;
+		return false;
+	}
+	TelemetryFile::Block block;
+	unsigned int events = 0;
+	for (uint32_t b = 0; b < reader.blocks(); b++) {
+		if (!reader.readBlock(b, block)) {
+			std::cerr << "Corrupt block " << b << " in telemetry file!" << std::endl;
+			return false;
+		}
+		for (unsigned int i = 0; i < block.events; i++) {
+			if (!insertEvent(block.name(TelemetryFile::INITIATOR, i), block.name(TelemetryFile::TARGET, i), block.name(TelemetryFile::CONTEXT, i))) return false;
+			if (++events % COMMIT_EVENTS == 0 && m_versions.hasReaders() && !commit()) return false;
+		}
+	}
+	return commit();
+}
+
+//everything one crawl keeps until it returns: the entity states, the queue, the interactions found and the associations being looked at
+//all of it (nodes, buckets and strings) comes from one Arena, so it costs a pointer bump to build and is freed in one go when the crawl ends
+class CrawlState {
+public:
+	typedef std::pair<const ArenaString, int> Entity;
+	struct Association {
+		Entity* entity; //the value: the other end of the interaction
+		ArenaString context;
+	};
+	typedef std::vector<Association, ArenaAllocator<Association> > AssociationList;
+	struct Interaction {
+		ArenaString context, from, to;
+		bool operator<(const Interaction& other) const { //same order as InteractionTuple's operator<
+			int c = context.compare(other.context);
+			if (c == 0) c = from.compare(other.from);
+			if (c == 0) c = to.compare(other.to);
+			return c < 0;
+		}
+	};
+
+	explicit CrawlState(Arena& a) : arena(a), state(0, ArenaStringHash(), std::equal_to<ArenaString>(), ArenaAllocator<Entity>(a)),
+		contexts(0, ArenaStringHash(), std::equal_to<ArenaString>(), ArenaAllocator<ArenaString>(a)), badEntitiesToBeProcessed(ArenaAllocator<Entity*>(a)),
+		interactionsSet(std::less<Interaction>(), ArenaAllocator<Interaction>(a)), badEntitiesFound(ArenaAllocator<ArenaString>(a)),
+		associations_i(ArenaAllocator<Association>(a)), associations_r(ArenaAllocator<Association>(a)) {
+		next = 0;
+	}
+	//the entity's state, added as 0 (with its name copied into the arena) the first time it's seen
+	Entity& entity(const std::string& name) {
+		std::unordered_map<ArenaString, int, ArenaStringHash, std::equal_to<ArenaString>, ArenaAllocator<Entity> >::iterator it = state.find(ArenaString(name));
+		if (it != state.end()) return *it;
+		return *state.insert(Entity(ArenaString(arena.copy(name.data(), name.size()), name.size()), 0)).first;
+	}
+	void addAssociation(const MultiMapTuple& m, AssociationList& associations) {
+		Association a;
+		a.entity = &entity(m.value);
+		a.context = context(m.context);
+		associations.push_back(a);
+	}
+	bool expand(Entity& key, bool is_initiator, size_t numAssociations, unsigned int minPrevalenceToBeGood);
+	//marks an entity knownGood lists as popular, as expand would once its searches found that many associations, so it needn't be searched
+	bool skipKnownGood(Entity& key, const std::string& name, const PrevalenceReport* knownGood, unsigned int minPrevalenceToBeGood, Stats& stats) {
+		if (knownGood == nullptr || key.second == 4) return false; //indicators are always expanded
+		unsigned int prevalence = knownGood->prevalence(name);
+		if (prevalence == 0 || prevalence < minPrevalenceToBeGood) return false;
+		key.second = 3;
+		(void)stats; //only read by STATS_ADD, which CYBERSPIDER_NO_STATS compiles out
+		STATS_ADD(stats.knownGoodSkipped, 1);
+		return true;
+	}
+	unsigned int finish(std::vector<std::string>& badEntities, std::vector<InteractionTuple>& interactions, uint64_t loopStart, uint64_t searchNs, Stats& stats);
+
+	Arena& arena;
+	//whether each entity shouldn't be processed (0), needs to be processed [and is an initiator (4)] or [and isn't initiator (1)], or has already been processed [and isn't popular (2)] or [and is popular (3)]
+	//unordered_map never moves its elements, so the rest of the crawl refers to entities by pointer
+	std::unordered_map<ArenaString, int, ArenaStringHash, std::equal_to<ArenaString>, ArenaAllocator<Entity> > state;
+	std::unordered_set<ArenaString, ArenaStringHash, std::equal_to<ArenaString>, ArenaAllocator<ArenaString> > contexts; //each machine name is stored once
+	std::vector<Entity*, ArenaAllocator<Entity*> > badEntitiesToBeProcessed; //queue of bad entities that need to be processed (ie searched for associations): [next, end)
+	size_t next;
+	std::set<Interaction, std::less<Interaction>, ArenaAllocator<Interaction> > interactionsSet; //set of all bad interactions (for efficient insertion and collision prevention)
+	std::vector<ArenaString, ArenaAllocator<ArenaString> > badEntitiesFound;
+	AssociationList associations_i, associations_r; //initiator and receiver associations of the entity being expanded, reused for every entity
+
+private:
+	ArenaString context(const std::string& name) {
+		std::unordered_set<ArenaString, ArenaStringHash, std::equal_to<ArenaString>, ArenaAllocator<ArenaString> >::iterator it = contexts.find(ArenaString(name));
+		if (it != contexts.end()) return *it;
+		return *contexts.insert(ArenaString(arena.copy(name.data(), name.size()), name.size())).first;
+	}
+};
+
+//one crawl step once an entity's searches are done: skip it if it's popular, otherwise it's bad and every entity it touched is queued
+//numAssociations counts the associations a filter left out of the lists too, so popularity doesn't depend on the filter
+bool CrawlState::expand(Entity& key, bool is_initiator, size_t numAssociations, unsigned int minPrevalenceToBeGood) {
+	if (numAssociations >= minPrevalenceToBeGood && !is_initiator) {
+		key.second = 3; //set state so this key isn't accessed again (and indicates that it's a popular entity)
+		return false; //this key has enough prevalence to be skipped or the key doesn't have any associations
+	}
+	if (numAssociations == 0) return false;
+
+	key.second = 2; //set state indicating this was a badEntity
+	badEntitiesFound.push_back(key.first);
+	for (size_t i = 0; i < associations_i.size(); i++) {
+		Association& a = associations_i[i];
+		if (a.entity->second == 0) {
+			badEntitiesToBeProcessed.push_back(a.entity); //add it to the process queue
+			a.entity->second = 1; //set state indicating this value needs to be processed
+		}
+		Interaction bad_interaction = { a.context, key.first, a.entity->first };
+		interactionsSet.insert(bad_interaction); //inserting to set will prevent duplicates
+	}
+	for (size_t i = 0; i < associations_r.size(); i++) {
+		Association& a = associations_r[i];
+		if (a.entity->second == 0) {
+			badEntitiesToBeProcessed.push_back(a.entity); //add it to the process queue
+			a.entity->second = 1; //set state indicating this value needs to be processed
+		}
+		Interaction bad_interaction = { a.context, a.entity->first, key.first };
+		interactionsSet.insert(bad_interaction); //inserting to set will prevent duplicates
 	}
 	return true;
 }
 
-unsigned int IntelWeb::crawl(const std::vector<std::string>& indicators, unsigned int minPrevalenceToBeGood, std::vector<std::string>& badEntitiesFound, std::vector<InteractionTuple>& interactions) {
-	unsigned int numBadEntities = 0;
+//records the phase timings and copies the results out of the arena in sorted order
+unsigned int CrawlState::finish(std::vector<std::string>& badEntities, std::vector<InteractionTuple>& interactions, uint64_t loopStart, uint64_t searchNs, Stats& stats) {
+	uint64_t outputStart = STATS_NOW();
+	(void)outputStart; (void)loopStart; (void)searchNs; (void)stats; //only read by the STATS_ macros, which CYBERSPIDER_NO_STATS compiles out
+	STATS_ADD(stats.crawls, 1);
+	STATS_RECORD(stats.crawlSearchNs, searchNs);
+	STATS_RECORD(stats.crawlExpandNs, outputStart - loopStart - searchNs);
+
+	std::sort(badEntitiesFound.begin(), badEntitiesFound.end());
+	badEntities.reserve(badEntitiesFound.size());
+	for (size_t i = 0; i < badEntitiesFound.size(); i++)
+		badEntities.push_back(badEntitiesFound[i].str());
+	interactions.reserve(interactionsSet.size());
+	for (std::set<Interaction, std::less<Interaction>, ArenaAllocator<Interaction> >::const_iterator it = interactionsSet.begin(); it != interactionsSet.end(); it++) {
+		interactions.push_back(InteractionTuple(it->from.str(), it->to.str(), it->context.str())); //in-order traversal through std::set of interactions will result in sorted order
+	}
+	STATS_RECORD(stats.crawlOutputNs, STATS_NOW() - outputStart);
+	STATS_RECORD(stats.crawlArenaBytes, arena.bytesAllocated());
+	return (unsigned int)badEntitiesFound.size();
+}
+
+//crawl and purge only need insert/search/erase and an Iterator, so they are shared by both engines
+template<typename MultiMap>
+static unsigned int crawlEvents(MultiMap& initiator_events, MultiMap& target_events, const std::vector<std::string>& indicators, unsigned int minPrevalenceToBeGood, std::vector<std::string>& badEntitiesFound, std::vector<InteractionTuple>& interactions, const ValueFilter* filter, const PrevalenceReport* knownGood, Stats& stats) {
 	interactions.clear();
 	badEntitiesFound.clear();
-	std::unordered_map<std::string, int> state; //stores whether entity shouldn't be processed (0), needs to be processed [and is an initiator (4)] or [and isn't initiator (1)], or has already been processed [and isn't popular (2)] or [and is popular (3)] 
-
-	std::queue<std::string> badEntitiesToBeProcessed; //store bad entities that need to be processed (ie searched for associations)
-	std::set<InteractionTuple> interactionsSet; //set of all bad interactions (for efficient insertion and collision prevention)
+	Arena arena;
+	CrawlState crawl(arena);
 
 	for (std::vector<std::string>::const_iterator it = indicators.begin(); it != indicators.end(); it++) {
-		state[*it] = 4; //set state indicating it needs to be processed (and was an initiator)
-		badEntitiesToBeProcessed.push(*it);
+		CrawlState::Entity& indicator = crawl.entity(*it);
+		indicator.second = 4; //set state indicating it needs to be processed (and was an initiator)
+		crawl.badEntitiesToBeProcessed.push_back(&indicator);
 	}
 
-	while (!badEntitiesToBeProcessed.empty()) {
-		std::string key = badEntitiesToBeProcessed.front(); badEntitiesToBeProcessed.pop(); 
-		vector<MultiMapTuple> associations_i, associations_r; //initiator and receiver associations
-		
+	//expand phase time is the whole loop minus the time spent in search and iteration
+	uint64_t searchNs = 0, loopStart = STATS_NOW();
+	std::string key; //reused so searching doesn't need a new string per entity
+	while (crawl.next < crawl.badEntitiesToBeProcessed.size()) {
+		CrawlState::Entity& entity = *crawl.badEntitiesToBeProcessed[crawl.next++];
+		key.assign(entity.first.data, entity.first.length);
+		if (crawl.skipKnownGood(entity, key, knownGood, minPrevalenceToBeGood, stats)) continue;
+		crawl.associations_i.clear();
+		crawl.associations_r.clear();
+
 		//go through all of this key's associations and add potential bad entities (ie. entities that haven't been processed yet or have too low prevalence)
-		DiskMultiMap::Iterator it_i = initiator_events.search(key), it_r = target_events.search(key);
+		uint64_t searchStart = STATS_NOW();
+		typename MultiMap::Iterator it_i = initiator_events.search(key), it_r = target_events.search(key);
 		unsigned int numAssociations = 0;
-		bool is_initiator = (state[key] == 4);
+		bool is_initiator = (entity.second == 4);
 		while (it_i.isValid() && (is_initiator || numAssociations < minPrevalenceToBeGood)) { //associations where key is initiator
 			numAssociations++;
-			associations_i.push_back(*it_i);
+			if (filter == nullptr || it_i.matches(*filter)) crawl.addAssociation(*it_i, crawl.associations_i);
 			++it_i;
 		}
 		while (it_r.isValid() && (is_initiator || numAssociations < minPrevalenceToBeGood)) { //associations where key is receiver
 			numAssociations++;
-			associations_r.push_back(*it_r);
+			if (filter == nullptr || it_r.matches(*filter)) crawl.addAssociation(*it_r, crawl.associations_r);
 			++it_r;
 		}
-		if (numAssociations >= minPrevalenceToBeGood && !is_initiator) {
-			state[key] = 3; //set state so this key isn't accessed again (and indicates that it's a popular entity)
-			continue; //this key has enough prevalence to be skipped or the key doesn't have any associations
-		}
-		if (numAssociations == 0) continue;
+		searchNs += STATS_NOW() - searchStart;
+		crawl.expand(entity, is_initiator, numAssociations, minPrevalenceToBeGood);
+	}
 
-		state[key] = 2; //set state indicating this was a badEntity
-		badEntitiesFound.push_back(key);
-		numBadEntities++;
-		
-		for (int i = 0; i < associations_i.size(); i++) {
-			MultiMapTuple &mmt = associations_i[i];
-			if (state[mmt.value] == 0) {
-				badEntitiesToBeProcessed.push(mmt.value); //add it to the process queue
-				state[mmt.value] = 1; //set state indicating this value needs to be processed
+	return crawl.finish(badEntitiesFound, interactions, loopStart, searchNs, stats);
+}
+
+unsigned int IntelWeb::crawl(const std::vector<std::string>& indicators, unsigned int minPrevalenceToBeGood, std::vector<std::string>& badEntitiesFound, std::vector<InteractionTuple>& interactions, unsigned int concurrency, const ValueFilter* filter, const PrevalenceReport* knownGood) {
+	if (filter != nullptr && filter->empty()) filter = nullptr;
+	if (m_engine == LSM) return crawlEvents(lsm_initiator_events, lsm_target_events, indicators, minPrevalenceToBeGood, badEntitiesFound, interactions, filter, knownGood, m_stats);
+	if (concurrency > 1 && openAsync(concurrency))
+		return crawlConcurrent(indicators, minPrevalenceToBeGood, badEntitiesFound, interactions, concurrency, filter, knownGood);
+	return crawlEvents(initiator_events, target_events, indicators, minPrevalenceToBeGood, badEntitiesFound, interactions, filter, knownGood, m_stats);
+}
+
+bool IntelWeb::openAsync(unsigned int concurrency) {
+	//the AsyncFile reads through its own handles, so anything ingest or purge left in the fstreams has to reach the files first
+	if (!initiator_events.flush() || !target_events.flush()) return false;
+	if (m_asyncConcurrency == concurrency) return true;
+	m_asyncConcurrency = 0;
+	//each entity being expanded has a read in flight on both maps, in whichever shards its name is in
+	bool success = m_async.open(2 * concurrency);
+	for (unsigned int i = 0; success && i < initiator_events.shards(); i++)
+		success = m_async.addFile(initiator_events.shard(i).filename()) == (int)(2 * i) && m_async.addFile(target_events.shard(i).filename()) == (int)(2 * i + 1);
+	if (!success) {
+		m_async.close();
+		return false;
+	}
+	m_asyncConcurrency = concurrency;
+	return true;
+}
+
+//crawlEvents with up to concurrency entities in progress at once
+//each entity's searches are DiskMultiMap::Lookups, resumed as their reads complete, so one thread keeps many chain walks waiting on the disk and the crawl state needs no locking
+//an entity is classified from its own associations alone, so expanding in a different order finds the same entities and interactions
+unsigned int IntelWeb::crawlConcurrent(const std::vector<std::string>& indicators, unsigned int minPrevalenceToBeGood,
+	std::vector<std::string>& badEntitiesFound, std::vector<InteractionTuple>& interactions, unsigned int concurrency, const ValueFilter* filter,
+	const PrevalenceReport* knownGood) {
+	struct Expansion {
+		CrawlState::Entity* entity;
+		std::string key; //reused for every entity this slot expands
+		bool is_initiator;
+		int pending; //Lookups still reading
+		DiskMultiMap::Lookup lookups[2]; //initiator_events, target_events
+	};
+	interactions.clear();
+	badEntitiesFound.clear();
+	Arena arena;
+	CrawlState crawl(arena);
+	for (std::vector<std::string>::const_iterator it = indicators.begin(); it != indicators.end(); it++) {
+		CrawlState::Entity& indicator = crawl.entity(*it);
+		indicator.second = 4;
+		crawl.badEntitiesToBeProcessed.push_back(&indicator);
+	}
+
+	//the thread pool caps its queue depth, so there may be room for fewer expansions than asked for
+	std::vector<Expansion> expansions(std::max(1u, std::min(concurrency, m_async.queueDepth() / 2)));
+	std::vector<size_t> freeSlots;
+	for (size_t i = expansions.size(); i > 0; i--) freeSlots.push_back(i - 1);
+	ShardedMultiMap* maps[2] = { &initiator_events, &target_events };
+	std::vector<AsyncFile::Completion> completions;
+	AsyncFile::Request request;
+	bool failed = false; //a read failed or wasn't taken: no more entities are started, and the crawl is redone sequentially
+	auto finishExpansion = [&](size_t slot) {
+		Expansion& e = expansions[slot];
+		if (e.lookups[0].failed() || e.lookups[1].failed()) failed = true;
+		crawl.associations_i.clear();
+		crawl.associations_r.clear();
+		for (const auto& m : e.lookups[0].values()) crawl.addAssociation(m, crawl.associations_i);
+		for (const auto& m : e.lookups[1].values()) crawl.addAssociation(m, crawl.associations_r);
+		crawl.expand(*e.entity, e.is_initiator, e.lookups[0].scanned() + e.lookups[1].scanned(), minPrevalenceToBeGood);
+		freeSlots.push_back(slot);
+	};
+
+	//search phase time is the time spent waiting for reads
+	uint64_t searchNs = 0, loopStart = STATS_NOW();
+	for (;;) {
+		while (!failed && !freeSlots.empty() && crawl.next < crawl.badEntitiesToBeProcessed.size()) {
+			size_t slot = freeSlots.back();
+			Expansion& e = expansions[slot];
+			e.entity = crawl.badEntitiesToBeProcessed[crawl.next++];
+			e.key.assign(e.entity->first.data, e.entity->first.length);
+			if (crawl.skipKnownGood(*e.entity, e.key, knownGood, minPrevalenceToBeGood, m_stats)) continue; //the slot stays free
+			freeSlots.pop_back();
+			e.is_initiator = (e.entity->second == 4);
+			//crawlEvents stops reading at minPrevalenceToBeGood associations, so each map never needs more than that for non-indicators
+			unsigned int maxValues = e.is_initiator ? UINT_MAX : minPrevalenceToBeGood;
+			e.pending = 0;
+			for (unsigned int m = 0; m < 2; m++) {
+				unsigned int shard = maps[m]->shardOf(e.key);
+				if (e.lookups[m].start(maps[m]->shard(shard), e.key, 2 * shard + m, maxValues, request, filter)) {
+					request.tag = slot * 2 + m;
+					if (m_async.submit(request)) e.pending++;
+					else e.lookups[m].resume(false, request);
+				}
 			}
-			InteractionTuple bad_interaction(key, mmt.value, mmt.context);
-			interactionsSet.insert(bad_interaction); //inserting to set will prevent duplicates
+			if (e.pending == 0) finishExpansion(slot);
 		}
-		for (int i = 0; i < associations_r.size(); i++) {
-			MultiMapTuple &mmt = associations_r[i];
-			if (state[mmt.value] == 0) {
-				badEntitiesToBeProcessed.push(mmt.value); //add it to the process queue
-				state[mmt.value] = 1; //set state indicating this value needs to be processed
+		if (m_async.inFlight() == 0) break;
+
+		uint64_t waitStart = STATS_NOW();
+		completions.clear();
+		m_async.wait(completions);
+		searchNs += STATS_NOW() - waitStart;
+		for (const auto& completion : completions) {
+			size_t slot = (size_t)(completion.tag / 2);
+			Expansion& e = expansions[slot];
+			DiskMultiMap::Lookup& lookup = e.lookups[completion.tag % 2];
+			if (lookup.resume(completion.ok, request)) {
+				request.tag = completion.tag;
+				if (m_async.submit(request)) continue;
+				lookup.resume(false, request);
 			}
-			InteractionTuple bad_interaction(mmt.value, key, mmt.context);
-			interactionsSet.insert(bad_interaction); //inserting to set will prevent duplicates
+			if (--e.pending == 0) finishExpansion(slot);
 		}
 	}
 
-	std::sort(badEntitiesFound.begin(), badEntitiesFound.end());
-	for (std::set<InteractionTuple>::const_iterator it = interactionsSet.begin(); it != interactionsSet.end(); it++) {
-		interactions.push_back(*it); //in-order traversal through std::set of interactions will result in sorted order
-	}
+	//an entity whose search failed would be classified from part of its associations, so rather than return different results the
+	//crawl starts over one search at a time through the maps' own files
+	if (failed) return crawlEvents(initiator_events, target_events, indicators, minPrevalenceToBeGood, badEntitiesFound, interactions, filter, knownGood, m_stats);
+	return crawl.finish(badEntitiesFound, interactions, loopStart, searchNs, m_stats);
+}
 
-	return numBadEntities;
+Stats IntelWeb::stats() const {
+	Stats s = m_stats;
+	if (m_engine == LSM) {
+		s.merge(lsm_initiator_events.stats());
+		s.merge(lsm_target_events.stats());
+	} else {
+		s.merge(initiator_events.stats());
+		s.merge(target_events.stats());
+		s.io.merge(m_async.ioStats()); //the concurrent crawl's reads, which go through m_async rather than the maps' own files
+	}
+	return s;
 }
 
-bool IntelWeb::purge(const std::string& entity) {
+template<typename MultiMap>
+static bool purgeEvents(MultiMap& initiator_events, MultiMap& target_events, const std::string& entity) {
+	//only associations that were found are erased, so purging an entity that isn't there writes nothing
 	bool purged = false;
-	DiskMultiMap::Iterator it_i, it_r;
-	do {
-		it_i = initiator_events.search(entity);
+	typename MultiMap::Iterator it_i;
+	for (it_i = initiator_events.search(entity); it_i.isValid(); it_i = initiator_events.search(entity)) {
 		MultiMapTuple mmt = *it_i;
 		initiator_events.erase(mmt.key, mmt.value, mmt.context);
 		target_events.erase(mmt.value, mmt.key, mmt.context); //target events have key and value swapped
 		purged = true;
-	} while (it_i.isValid());
+	}
 
-	do {
-		it_i = target_events.search(entity);
+	for (it_i = target_events.search(entity); it_i.isValid(); it_i = target_events.search(entity)) {
 		MultiMapTuple mmt = *it_i;
 		target_events.erase(mmt.key, mmt.value, mmt.context);
 		initiator_events.erase(mmt.value, mmt.key, mmt.context); //initiator events have key and value swapped
 		purged = true;
-	} while (it_i.isValid());
+	}
 
 	return purged;
-}
\ No newline at end of file
+}
+
+//an LSMMultiMap search merges the key's whole list from every run, so purgeEvents' search and erase per association would make purging a
+//hub quadratic: instead the entity's lists are each read once, the other end of every association is erased, and the entity's own keys go
+//with one key tombstone each. An entity that isn't there gets no tombstones, so purging it writes nothing, as with the other engines
+//an erase removes every copy of its association, so each distinct one is erased once, and one that erases nothing means the maps disagree
+static bool purgeLSMEvents(LSMMultiMap& initiator_events, LSMMultiMap& target_events, const std::string& entity) {
+	std::set<std::pair<std::string, std::string> > initiated, targeted; //(other entity, context)
+	for (LSMMultiMap::Iterator it = initiator_events.search(entity); it.isValid(); ++it) {
+		MultiMapTuple mmt = *it;
+		initiated.insert(std::make_pair(mmt.value, mmt.context));
+	}
+	for (LSMMultiMap::Iterator it = target_events.search(entity); it.isValid(); ++it) {
+		MultiMapTuple mmt = *it;
+		targeted.insert(std::make_pair(mmt.value, mmt.context));
+	}
+	if (initiated.empty() && targeted.empty()) return false;
+	for (std::set<std::pair<std::string, std::string> >::const_iterator it = initiated.begin(); it != initiated.end(); it++)
+		if (target_events.erase(it->first, entity, it->second) == 0) return false; //target events have key and value swapped
+	for (std::set<std::pair<std::string, std::string> >::const_iterator it = targeted.begin(); it != targeted.end(); it++)
+		if (initiator_events.erase(it->first, entity, it->second) == 0) return false; //initiator events have key and value swapped
+	return initiator_events.eraseKey(entity) && target_events.eraseKey(entity);
+}
+
+bool IntelWeb::purge(const std::string& entity) {
+	if (m_snapshotOf != nullptr) return false;
+	if (m_engine == LSM) return purgeLSMEvents(lsm_initiator_events, lsm_target_events, entity);
+	//nothing changed if the entity wasn't there, so there's no generation to commit and no header to rewrite
+	//a purge that did erase commits whether or not a snapshot is pinned, as the end of an ingest does: a reader that pins later would
+	//otherwise wait on a generation no call is left to commit
+	if (!purgeEvents(initiator_events, target_events, entity)) return false;
+	return commit();
+}
+//every .dmm file is scanned front to back on a thread of its own (DiskMultiMap::analyze), which visits each live key with its number of values
+//a key is in the same shard of both maps, so each shard's two files are then joined on their keys' hashes, a thread per shard, with no table
+//of every entity; only the hubs' names are read back, one KeyTuple each
+bool IntelWeb::reportPrevalence(PrevalenceReport& report, size_t topK) {
+	report.clear();
+	if (m_engine == LSM || !initiator_events.isOpen()) return false;
+	std::vector<DiskMultiMap*> files; //numbered as in m_async: 2*shard for initiator_events, 2*shard+1 for target_events
+	for (unsigned int i = 0; i < initiator_events.shards(); i++) {
+		files.push_back(&initiator_events.shard(i));
+		files.push_back(&target_events.shard(i));
+	}
+	std::vector<std::vector<PrevalenceReport::KeyCount> > keys(files.size());
+	std::vector<char> scanned(files.size(), false);
+	std::vector<std::thread> threads;
+	for (size_t f = 0; f < files.size(); f++) {
+		threads.push_back(std::thread([&files, &keys, &scanned, f]() {
+			DiskMultiMap::Analysis analysis;
+			std::vector<PrevalenceReport::KeyCount>& fileKeys = keys[f];
+			scanned[f] = files[f]->analyze(analysis, 0, [&fileKeys](uint64_t hash, unsigned int values, BinaryFile::Offset keyTuple) {
+				PrevalenceReport::KeyCount key = { hash, keyTuple, values };
+				fileKeys.push_back(key);
+			}) && analysis.ok;
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+	threads.clear();
+	if (std::find(scanned.begin(), scanned.end(), false) != scanned.end()) return false;
+
+	std::vector<PrevalenceReport> shards(initiator_events.shards());
+	for (unsigned int i = 0; i < shards.size(); i++) {
+		threads.push_back(std::thread([&shards, &keys, i, topK]() {
+			shards[i].addShard(keys[2 * i], keys[2 * i + 1], 2 * i, 2 * i + 1, topK);
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+	std::vector<std::vector<PrevalenceReport::KeyCount> >().swap(keys);
+	for (size_t i = 0; i < shards.size(); i++) report.merge(shards[i], topK);
+
+	std::string name;
+	for (size_t i = 0; i < report.candidates().size(); i++) {
+		const PrevalenceReport::Candidate& c = report.candidates()[i];
+		if (!files[c.file]->readKey(c.keyTuple, name)) return false;
+		report.addHub(name, c.prevalence);
+	}
+	report.sortHubs();
+	return true;
+}
@@ -3,29 +3,101 @@
 
 #include "InteractionTuple.h"
 #include "DiskMultiMap.h"
+#include "ShardedMultiMap.h"
+#include "LSMMultiMap.h"
+#include "Stats.h"
+#include "KeyHash.h"
+#include "AsyncFile.h"
+#include "PageVersions.h"
+#include "ValueFilter.h"
+#include "TelemetryFile.h"
+#include "PrevalenceReport.h"
 #include <fstream>
 #include <string>
 #include <vector>
 
+class ShardWriters;
+
 class IntelWeb {
 public:
+	enum Engine {
+		HASH, //DiskMultiMap: in-place hash chains (-initiator.dmm/-target.dmm)
+		LSM, //LSMMultiMap: memtable and sorted runs (-initiator.lsm/-target.lsm)
+		PAGED //DiskMultiMap with 4KB bucket pages of key fingerprints (-initiator.dmm/-target.dmm)
+	};
+
 	IntelWeb();
 	~IntelWeb();
-	bool createNew(const std::string& filePrefix, unsigned int maxDataItems);
+	//hashFunction only applies to the HASH and PAGED engines
+	//with shardPrefixes (HASH and PAGED only) the maps are split by key across one pair of .dmm files per prefix, which can be on different
+	//disks: filePrefix.shards lists the prefixes for openExisting, and each shard is sized for its share of maxDataItems
+	bool createNew(const std::string& filePrefix, unsigned int maxDataItems, Engine engine = HASH, HashFunction hashFunction = DEFAULT_HASH_FUNCTION,
+		const std::vector<std::string>& shardPrefixes = std::vector<std::string>());
 	bool openExisting(const std::string& filePrefix);
+	//the prefixes of a database's .dmm files: the ones in filePrefix.shards, or filePrefix itself if it isn't sharded
+	static std::vector<std::string> shardPrefixes(const std::string& filePrefix);
+	//a read-only view of live (a HASH or PAGED database that another thread may go on ingesting into and purging) as of live's latest commit
+	//crawls on it see that generation of both maps whatever live writes meanwhile; close it before live, and soon, since live keeps copies of
+	//the pages it overwrites for as long as a snapshot needs them
+	bool openSnapshot(IntelWeb& live);
 	void close();
+	//ingest commits a generation at the end, and purge after each entity it erased, for snapshots to pin; while a snapshot is pinned or waiting to pin,
+	//ingest also commits every COMMIT_EVENTS events (a commit flushes every file, and on a sharded database waits for every writer thread)
+	//an ingest that fails partway returns false but still commits the events it inserted before the failure
+	//telemetryFile is a text log or, if it starts with TelemetryFile::MAGIC, the binary format, which is mapped and inserted without parsing
+	//a sharded database gets a writer thread per shard, and this thread only parses and hands each insert to its key's shard
 	bool ingest(const std::string& telemetryFile);
+	//concurrency is how many entities are expanded at once; above 1 the HASH and PAGED engines overlap their searches' reads
+	//on one thread through an AsyncFile (the LSM engine always expands one at a time). The results are the same either way
+	//each search reads only its key's shard, so with shards on different disks the reads in flight are spread across them
+	//filter scopes the crawl: only interactions whose machine (context) and other entity (value) it accepts are followed and reported.
+	//Prevalence still counts every association, so an entity is bad or popular whatever the filter
+	//knownGood (a report of this database, see reportPrevalence) lets crawl skip searching the hubs it lists at minPrevalenceToBeGood or more,
+	//which the search would only have found to be popular; the results are the same as long as the report is still current
 	unsigned int crawl(const std::vector<std::string>& indicators,
 		unsigned int minPrevalenceToBeGood,
 		std::vector<std::string>& badEntitiesFound,
-		std::vector<InteractionTuple>& interactions
+		std::vector<InteractionTuple>& interactions,
+		unsigned int concurrency = 1,
+		const ValueFilter* filter = nullptr,
+		const PrevalenceReport* knownGood = nullptr
 		);
 	bool purge(const std::string& entity);
+	//every entity's prevalence from one sequential scan of each .dmm file, a thread per file (HASH and PAGED engines), and the topK hubs
+	//the hubs' prevalences are exact; entities whose names share a 64-bit hash would be counted together
+	bool reportPrevalence(PrevalenceReport& report, size_t topK);
+	Engine engine() const { return m_engine; }
+	unsigned int shards() const { return m_engine == LSM ? 1 : initiator_events.shards(); }
+	uint32_t generation() const; //latest commit, or the one a snapshot sees
+	PageVersions::Counters snapshotCounters() const { return m_versions.counters(); } //of the pages kept for this database's snapshots
+	Stats stats() const; //counters of the current engine's maps plus crawl phase timings
 
 private:
-	DiskMultiMap initiator_events, target_events;
+	static const unsigned int LSM_MEMTABLE_ENTRIES = 1 << 16;
+	static const unsigned int COMMIT_EVENTS = 1024;
+
+	void startVersions();
+	bool commit();
+	bool insertEvent(const std::string& initiator, const std::string& target, const std::string& context);
+	bool ingestText(const std::string& telemetryFile);
+	bool ingestBinary(const std::string& telemetryFile);
+	bool openAsync(unsigned int concurrency);
+	unsigned int crawlConcurrent(const std::vector<std::string>& indicators, unsigned int minPrevalenceToBeGood,
+		std::vector<std::string>& badEntitiesFound, std::vector<InteractionTuple>& interactions, unsigned int concurrency, const ValueFilter* filter,
+		const PrevalenceReport* knownGood);
+
+	Engine m_engine;
+	ShardedMultiMap initiator_events, target_events;
 	//initiator_events: stores mapping from initiator to all its targets
 	//target_events: stores mapping from receivers to all its initiators
+	LSMMultiMap lsm_initiator_events, lsm_target_events; //same mappings when the database uses the LSM engine
+	Stats m_stats;
+	AsyncFile m_async; //reads of every .dmm file for concurrent crawls: file 2*shard is that shard of initiator_events, 2*shard+1 of target_events
+	unsigned int m_asyncConcurrency;
+	PageVersions m_versions; //pages the HASH and PAGED engines overwrite, for snapshots of this database; shared by every shard of both maps
+	PageVersions* m_snapshotOf; //the live database's, if this is a snapshot
+	uint32_t m_snapshotGeneration;
+	ShardWriters* m_writers; //while a sharded database ingests
 
 }; 
 
@@ -0,0 +1,185 @@
+#include "KeyHash.h"
+#include <functional>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#endif
+
+//all multi-byte reads are assembled from bytes so the result doesn't depend on the platform's byte order or alignment
+static uint64_t read64(const unsigned char* p) {
+	return uint64_t(p[0]) | uint64_t(p[1]) << 8 | uint64_t(p[2]) << 16 | uint64_t(p[3]) << 24 |
+		uint64_t(p[4]) << 32 | uint64_t(p[5]) << 40 | uint64_t(p[6]) << 48 | uint64_t(p[7]) << 56;
+}
+static uint64_t read32(const unsigned char* p) {
+	return uint64_t(p[0]) | uint64_t(p[1]) << 8 | uint64_t(p[2]) << 16 | uint64_t(p[3]) << 24;
+}
+static uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t stdHash(const char* data, size_t length) {
+	return std::hash<std::string>()(std::string(data, length));
+}
+
+static uint64_t fnv1a(const char* data, size_t length) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < length; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+//xxHash64, following the published specification
+static const uint64_t XXH_P1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH_P2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH_P3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH_P4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH_P5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t xxhRound(uint64_t acc, uint64_t input) {
+	acc += input * XXH_P2;
+	acc = rotl64(acc, 31);
+	return acc * XXH_P1;
+}
+static uint64_t xxhMerge(uint64_t acc, uint64_t val) {
+	acc ^= xxhRound(0, val);
+	return acc * XXH_P1 + XXH_P4;
+}
+
+static uint64_t xxh64(const char* data, size_t length) {
+	const unsigned char* p = (const unsigned char*)data;
+	const unsigned char* end = p + length;
+	const uint64_t seed = 0;
+	uint64_t h;
+	if (length >= 32) {
+		uint64_t v1 = seed + XXH_P1 + XXH_P2, v2 = seed + XXH_P2, v3 = seed, v4 = seed - XXH_P1;
+		do {
+			v1 = xxhRound(v1, read64(p));
+			v2 = xxhRound(v2, read64(p + 8));
+			v3 = xxhRound(v3, read64(p + 16));
+			v4 = xxhRound(v4, read64(p + 24));
+			p += 32;
+		} while (end - p >= 32);
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxhMerge(h, v1); h = xxhMerge(h, v2); h = xxhMerge(h, v3); h = xxhMerge(h, v4);
+	}
+	else
+		h = seed + XXH_P5;
+	h += length;
+	for (; end - p >= 8; p += 8) {
+		h ^= xxhRound(0, read64(p));
+		h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (end - p >= 4) {
+		h ^= read32(p) * XXH_P1;
+		h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * XXH_P5;
+		h = rotl64(h, 11) * XXH_P1;
+	}
+	h ^= h >> 33; h *= XXH_P2;
+	h ^= h >> 29; h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+//wyhash final4 with its default secret
+static const uint64_t WY_P[4] = { 0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL };
+
+//full 64x64->128 multiply; a becomes the low half and b the high half
+static void wyMum(uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128)a * b;
+	a = (uint64_t)r; b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	a = _umul128(a, b, &b);
+#else
+	uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	a = lo; b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+static uint64_t wyMix(uint64_t a, uint64_t b) {
+	wyMum(a, b);
+	return a ^ b;
+}
+
+static uint64_t wyhashSeeded(const char* data, size_t length, uint64_t seed) {
+	const unsigned char* p = (const unsigned char*)data;
+	seed ^= wyMix(seed ^ WY_P[0], WY_P[1]);
+	uint64_t a, b;
+	if (length <= 16) {
+		if (length >= 4) {
+			size_t shift = (length >> 3) << 2;
+			a = (read32(p) << 32) | read32(p + shift);
+			b = (read32(p + length - 4) << 32) | read32(p + length - 4 - shift);
+		}
+		else if (length > 0) {
+			a = (uint64_t(p[0]) << 16) | (uint64_t(p[length >> 1]) << 8) | p[length - 1];
+			b = 0;
+		}
+		else
+			a = b = 0;
+	}
+	else {
+		size_t i = length;
+		if (i >= 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wyMix(read64(p) ^ WY_P[1], read64(p + 8) ^ seed);
+				see1 = wyMix(read64(p + 16) ^ WY_P[2], read64(p + 24) ^ see1);
+				see2 = wyMix(read64(p + 32) ^ WY_P[3], read64(p + 40) ^ see2);
+				p += 48; i -= 48;
+			} while (i >= 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wyMix(read64(p) ^ WY_P[1], read64(p + 8) ^ seed);
+			i -= 16; p += 16;
+		}
+		a = read64(p + i - 16);
+		b = read64(p + i - 8);
+	}
+	a ^= WY_P[1]; b ^= seed;
+	wyMum(a, b);
+	return wyMix(a ^ WY_P[0] ^ length, b ^ WY_P[1]);
+}
+
+static uint64_t wyhash(const char* data, size_t length) {
+	return wyhashSeeded(data, length, 0);
+}
+
+KeyHasher keyHasher(HashFunction f) {
+	switch (f) {
+	case HASH_STD: return stdHash;
+	case HASH_FNV1A: return fnv1a;
+	case HASH_XXH64: return xxh64;
+	case HASH_WYHASH: return wyhash;
+	default: return nullptr;
+	}
+}
+
+uint64_t hashKey(HashFunction f, const std::string& key) {
+	return keyHasher(f)(key.data(), key.size());
+}
+
+static const char* const HASH_NAMES[NUM_HASH_FUNCTIONS] = { "std", "fnv1a", "xxh64", "wyhash" };
+
+const char* hashName(HashFunction f) {
+	if (f < 0 || f >= NUM_HASH_FUNCTIONS) return "unknown";
+	return HASH_NAMES[f];
+}
+
+bool parseHashName(const std::string& name, HashFunction& f) {
+	for (int i = 0; i < NUM_HASH_FUNCTIONS; i++)
+		if (name == HASH_NAMES[i]) {
+			f = HashFunction(i);
+			return true;
+		}
+	return false;
+}
@@ -0,0 +1,27 @@
+#ifndef KEYHASH_H_
+#define KEYHASH_H_
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+//hash functions DiskMultiMap can place keys with; the one used is recorded in the file's header
+//every function except HASH_STD is defined byte by byte, so a file hashes the same on every compiler, library and platform
+enum HashFunction {
+	HASH_STD = 0, //std::hash<std::string>, only for files written before the header recorded a hash (not stable across toolchains)
+	HASH_FNV1A = 1, //64-bit FNV-1a
+	HASH_XXH64 = 2, //xxHash64, seed 0
+	HASH_WYHASH = 3, //wyhash (final4 constants), seed 0
+	NUM_HASH_FUNCTIONS
+};
+
+const HashFunction DEFAULT_HASH_FUNCTION = HASH_WYHASH;
+
+typedef uint64_t (*KeyHasher)(const char* data, size_t length);
+
+KeyHasher keyHasher(HashFunction f); //nullptr for an unknown value
+uint64_t hashKey(HashFunction f, const std::string& key);
+const char* hashName(HashFunction f);
+bool parseHashName(const std::string& name, HashFunction& f);
+
+#endif // KEYHASH_H_
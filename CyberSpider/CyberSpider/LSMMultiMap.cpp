@@ -0,0 +1,432 @@
+#include "LSMMultiMap.h"
+#include "BinaryFile.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+LSMMultiMap::Iterator::Iterator() {
+	m_pos = 0;
+}
+LSMMultiMap::Iterator::Iterator(const std::shared_ptr<std::vector<MultiMapTuple> >& tuples) {
+	m_tuples = tuples;
+	m_pos = 0;
+}
+bool LSMMultiMap::Iterator::isValid() const {
+	return m_tuples && m_pos < m_tuples->size();
+}
+LSMMultiMap::Iterator& LSMMultiMap::Iterator::operator++() {
+	if (isValid()) m_pos++;
+	return *this;
+}
+MultiMapTuple LSMMultiMap::Iterator::operator*() {
+	if (!isValid()) return MultiMapTuple(); //if the iterator isn't valid, return an empty multimap
+	return (*m_tuples)[m_pos];
+}
+bool LSMMultiMap::Iterator::matches(const ValueFilter& filter) const {
+	return isValid() && filter.accepts((*m_tuples)[m_pos].value, (*m_tuples)[m_pos].context);
+}
+
+bool LSMMultiMap::RunWriter::open(const std::string& filename) {
+	if (!file.createNew(filename)) return false;
+	pos = sizeof(RunHeader); count = 0;
+	buffer.clear(); indexKeys.clear(); indexOffsets.clear();
+	return true;
+}
+bool LSMMultiMap::RunWriter::append(const Entry& e) {
+	if (count % INDEX_INTERVAL == 0) {
+		//start of a new block, so remember where it starts in the sparse index
+		indexKeys.push_back(e.key);
+		indexOffsets.push_back(pos + (BinaryFile::Offset)buffer.size());
+	}
+	RecordHeader rh;
+	rh.seq = e.data.seq; rh.tombstone = e.data.tombstone;
+	rh.klen = (uint8_t)e.key.size(); rh.vlen = (uint8_t)e.data.value.size(); rh.clen = (uint8_t)e.data.context.size();
+	buffer.append(reinterpret_cast<const char*>(&rh), sizeof(rh));
+	buffer += e.key; buffer += e.data.value; buffer += e.data.context;
+	count++;
+	if (buffer.size() >= 65536) return flushBuffer();
+	return true;
+}
+bool LSMMultiMap::RunWriter::flushBuffer() {
+	if (buffer.empty()) return true;
+	if (!file.write(buffer.data(), buffer.size(), pos)) return false;
+	pos += (BinaryFile::Offset)buffer.size();
+	buffer.clear();
+	return true;
+}
+bool LSMMultiMap::RunWriter::finish() {
+	if (!flushBuffer()) return false;
+	RunHeader rh;
+	rh.magic = RUN_MAGIC; rh.numEntries = count; rh.indexOffset = pos; rh.numIndexEntries = (uint32_t)indexKeys.size();
+	//index is written after the records as (key length, key, offset) entries
+	for (size_t i = 0; i < indexKeys.size(); i++) {
+		uint8_t klen = (uint8_t)indexKeys[i].size();
+		buffer.append(reinterpret_cast<const char*>(&klen), sizeof(klen));
+		buffer += indexKeys[i];
+		buffer.append(reinterpret_cast<const char*>(&indexOffsets[i]), sizeof(BinaryFile::Offset));
+	}
+	if (!flushBuffer()) return false;
+	if (!file.write(rh, 0)) return false;
+	file.close();
+	return true;
+}
+
+bool LSMMultiMap::RunReader::open(const Run& run) {
+	if (!file.openExisting(run.filename)) return false;
+	blockStarts = run.indexOffsets;
+	blockStarts.push_back(run.indexOffset); //end of the last block
+	nextBlock = 0; m_pos = 0; m_block.clear();
+	return loadBlock();
+}
+bool LSMMultiMap::RunReader::loadBlock() {
+	m_block.clear(); m_pos = 0;
+	if (nextBlock + 1 >= blockStarts.size()) return true; //no blocks left, reader becomes invalid
+	bool ok = readBlock(file, blockStarts[nextBlock], blockStarts[nextBlock + 1], m_block);
+	nextBlock++;
+	return ok;
+}
+void LSMMultiMap::RunReader::next() {
+	if (++m_pos >= m_block.size()) loadBlock();
+}
+
+LSMMultiMap::LSMMultiMap() {
+	header.magic = MANIFEST_MAGIC;
+	header.memtableLimit = 0;
+	header.nextSeq = 0; header.nextRunId = 0; header.numRuns = 0;
+	memtableSize = 0;
+	compactionDone = false;
+	compactionOk = false;
+	compactionInputs = 0;
+	compactionRunId = 0;
+}
+LSMMultiMap::~LSMMultiMap() {
+	close();
+}
+
+std::string LSMMultiMap::runFilename(uint32_t id) const {
+	return m_filename + "." + std::to_string(id);
+}
+
+bool LSMMultiMap::writeManifest() {
+	header.numRuns = (uint32_t)runs.size();
+	if (!bf.write(header, 0)) return false;
+	for (size_t i = 0; i < runs.size(); i++) {
+		if (!bf.write(runs[i]->id, sizeof(ManifestHeader) + i*sizeof(uint32_t))) return false;
+	}
+	return true;
+}
+
+bool LSMMultiMap::createNew(const std::string& filename, unsigned int memtableLimit) {
+	close();
+
+	if (bf.createNew(filename)) {
+		m_filename = filename;
+		header.memtableLimit = memtableLimit > 0 ? memtableLimit : 1;
+		return writeManifest();
+	}
+	else return false;
+}
+bool LSMMultiMap::openExisting(const std::string& filename) {
+	close();
+
+	if (bf.openExisting(filename)) {
+		m_filename = filename;
+		if (!bf.read(header, 0) || header.magic != MANIFEST_MAGIC) return false;
+		for (uint32_t i = 0; i < header.numRuns; i++) {
+			uint32_t id;
+			if (!bf.read(id, sizeof(ManifestHeader) + i*sizeof(uint32_t))) return false;
+			std::shared_ptr<Run> run = openRun(id);
+			if (!run) return false;
+			runs.push_back(run);
+		}
+		return true;
+	}
+	else return false;
+}
+void LSMMultiMap::close() {
+	if (bf.isOpen()) {
+		finishCompaction(true);
+		flush(); //memtable only lives in memory, so it has to be written out before closing
+		finishCompaction(true);
+		bf.close();
+	}
+#ifndef CYBERSPIDER_NO_STATS
+	for (size_t i = 0; i < runs.size(); i++) retiredIo.merge(runs[i]->file.ioStats());
+#endif
+	runs.clear();
+	memtable.clear();
+	memtableSize = 0;
+	header.memtableLimit = 0;
+	header.nextSeq = 0; header.nextRunId = 0; header.numRuns = 0;
+}
+
+std::shared_ptr<LSMMultiMap::Run> LSMMultiMap::openRun(uint32_t id) {
+	std::shared_ptr<Run> run = std::make_shared<Run>();
+	run->id = id;
+	run->filename = runFilename(id);
+	RunHeader rh;
+	if (!run->file.openExisting(run->filename) || !run->file.read(rh, 0) || rh.magic != RUN_MAGIC) return nullptr;
+	run->indexOffset = rh.indexOffset;
+	//a flush cut short by a crash leaves a truncated run, whose index can point past the end of the file
+	BinaryFile::Offset fileLength = run->file.fileLength();
+	if (rh.indexOffset < (BinaryFile::Offset)sizeof(RunHeader) || rh.indexOffset > fileLength) return nullptr;
+	//the sparse index is small, so it is read in a single sequential read and kept in memory
+	BinaryFile::Offset length = fileLength - rh.indexOffset;
+	std::vector<char> buf(length);
+	if (length > 0 && !run->file.read(buf.data(), length, rh.indexOffset)) return nullptr;
+	size_t p = 0;
+	for (uint32_t i = 0; i < rh.numIndexEntries; i++) {
+		if (p + 1 > buf.size()) return nullptr;
+		uint8_t klen = (uint8_t)buf[p++];
+		if (p + klen + sizeof(BinaryFile::Offset) > buf.size()) return nullptr;
+		run->indexKeys.push_back(std::string(&buf[p], klen)); p += klen;
+		BinaryFile::Offset offset;
+		memcpy(&offset, &buf[p], sizeof(offset)); p += sizeof(offset);
+		run->indexOffsets.push_back(offset);
+	}
+	return run;
+}
+
+bool LSMMultiMap::readBlock(BinaryFile& file, BinaryFile::Offset from, BinaryFile::Offset to, std::vector<Entry>& entries) {
+	if (to < from) return false;
+	std::vector<char> buf(to - from);
+	if (!buf.empty() && !file.read(buf.data(), buf.size(), from)) return false;
+	size_t p = 0;
+	while (p + sizeof(RecordHeader) <= buf.size()) {
+		RecordHeader rh;
+		memcpy(&rh, &buf[p], sizeof(rh)); p += sizeof(rh);
+		if (p + rh.klen + rh.vlen + rh.clen > buf.size()) return false;
+		Entry e;
+		e.key.assign(&buf[p], rh.klen); p += rh.klen;
+		e.data.value.assign(&buf[p], rh.vlen); p += rh.vlen;
+		e.data.context.assign(&buf[p], rh.clen); p += rh.clen;
+		e.data.seq = rh.seq; e.data.tombstone = rh.tombstone;
+		entries.push_back(e);
+	}
+	return true;
+}
+
+bool LSMMultiMap::insert(const std::string& key, const std::string& value, const std::string& context) {
+	if (!bf.isOpen()) return false;
+	if (key.length() > 120 || value.length() > 120 || context.length() > 120) return false;
+	finishCompaction(false);
+	STATS_ADD(m_stats.inserts, 1);
+	MemEntry e;
+	e.value = value; e.context = context; e.seq = header.nextSeq++; e.tombstone = LIVE;
+	memtable[key].push_back(e);
+	if (++memtableSize >= header.memtableLimit) return flush();
+	return true;
+}
+
+void LSMMultiMap::searchRun(Run& run, const std::string& key, std::vector<Entry>& found) {
+	if (run.indexKeys.empty() || key < run.indexKeys[0]) return;
+	//the previous block can also end with this key, so start one block before the first index key >= key
+	size_t b = std::lower_bound(run.indexKeys.begin(), run.indexKeys.end(), key) - run.indexKeys.begin();
+	if (b > 0) b--;
+	STATS_ADD(m_stats.runsProbed, 1);
+	for (; b < run.indexKeys.size(); b++) {
+		if (run.indexKeys[b] > key) break;
+		BinaryFile::Offset end = (b + 1 < run.indexOffsets.size()) ? run.indexOffsets[b + 1] : run.indexOffset;
+		STATS_ADD(m_stats.blocksRead, 1);
+		std::vector<Entry> block;
+		if (!readBlock(run.file, run.indexOffsets[b], end, block)) return;
+		for (size_t i = 0; i < block.size(); i++) {
+			if (block[i].key == key) found.push_back(block[i]);
+			else if (block[i].key > key) return;
+		}
+	}
+}
+
+void LSMMultiMap::applyTombstones(std::vector<Entry>& entries) {
+	//entries are in seq order, so a tombstone only removes the matching values inserted before it
+	std::vector<Entry> live;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].data.tombstone == KEY_TOMBSTONE) {
+			live.clear();
+		} else if (entries[i].data.tombstone == VALUE_TOMBSTONE) {
+			std::vector<Entry>::iterator it = live.begin();
+			while (it != live.end()) {
+				if (it->data.value == entries[i].data.value && it->data.context == entries[i].data.context) it = live.erase(it);
+				else ++it;
+			}
+		} else {
+			live.push_back(entries[i]);
+		}
+	}
+	entries.swap(live);
+}
+
+LSMMultiMap::Iterator LSMMultiMap::search(const std::string& key) {
+	if (!bf.isOpen()) return Iterator();
+	finishCompaction(false);
+	STATS_ADD(m_stats.searches, 1);
+	std::vector<Entry> found;
+	for (size_t i = 0; i < runs.size(); i++) searchRun(*runs[i], key, found);
+	std::map<std::string, std::vector<MemEntry> >::const_iterator mt = memtable.find(key);
+	if (mt != memtable.end()) {
+		for (size_t i = 0; i < mt->second.size(); i++) {
+			Entry e; e.key = key; e.data = mt->second[i];
+			found.push_back(e);
+		}
+	}
+	std::stable_sort(found.begin(), found.end(), [](const Entry& a, const Entry& b) { return a.data.seq < b.data.seq; });
+	applyTombstones(found);
+	if (found.empty()) return Iterator();
+
+	std::shared_ptr<std::vector<MultiMapTuple> > tuples = std::make_shared<std::vector<MultiMapTuple> >();
+	for (size_t i = 0; i < found.size(); i++) {
+		MultiMapTuple m;
+		m.key = key; m.value = found[i].data.value; m.context = found[i].data.context;
+		tuples->push_back(m);
+	}
+	return Iterator(tuples);
+}
+
+int LSMMultiMap::erase(const std::string& key, const std::string& value, const std::string& context) {
+	if (!bf.isOpen()) return 0;
+	//erase has to report how many values it removed, so count the live matches before writing a tombstone
+	STATS_ADD(m_stats.erases, 1);
+	int num_deleted = 0;
+	for (Iterator it = search(key); it.isValid(); ++it) {
+		MultiMapTuple m = *it;
+		if (m.value == value && m.context == context) num_deleted++;
+	}
+	if (num_deleted == 0) return 0;
+	MemEntry e;
+	e.value = value; e.context = context; e.seq = header.nextSeq++; e.tombstone = VALUE_TOMBSTONE;
+	memtable[key].push_back(e);
+	if (++memtableSize >= header.memtableLimit) flush();
+	return num_deleted;
+}
+
+bool LSMMultiMap::eraseKey(const std::string& key) {
+	if (!bf.isOpen()) return false;
+	finishCompaction(false);
+	STATS_ADD(m_stats.erases, 1);
+	//the key's values before the tombstone are no longer needed in the memtable either; what's in the runs goes at the next compaction
+	std::vector<MemEntry>& values = memtable[key];
+	memtableSize -= (unsigned int)values.size();
+	values.clear();
+	MemEntry e;
+	e.seq = header.nextSeq++; e.tombstone = KEY_TOMBSTONE;
+	values.push_back(e);
+	if (++memtableSize >= header.memtableLimit) return flush();
+	return true;
+}
+
+bool LSMMultiMap::flush() {
+	if (!bf.isOpen()) return false;
+	if (memtable.empty()) return writeManifest();
+	uint32_t id = header.nextRunId++;
+	RunWriter writer;
+	if (!writer.open(runFilename(id))) return false;
+	//std::map iterates in key order and each key's values are already in seq order, so the run comes out sorted
+	for (std::map<std::string, std::vector<MemEntry> >::const_iterator it = memtable.begin(); it != memtable.end(); it++) {
+		for (size_t i = 0; i < it->second.size(); i++) {
+			Entry e; e.key = it->first; e.data = it->second[i];
+			if (!writer.append(e)) return false;
+		}
+	}
+	if (!writer.finish()) return false;
+	STATS_ADD(m_stats.flushes, 1);
+#ifndef CYBERSPIDER_NO_STATS
+	retiredIo.merge(writer.ioStats());
+#endif
+	std::shared_ptr<Run> run = openRun(id);
+	if (!run) return false;
+	runs.push_back(run);
+	memtable.clear();
+	memtableSize = 0;
+	if (!writeManifest()) return false;
+	if (runs.size() >= COMPACTION_TRIGGER) startCompaction();
+	return true;
+}
+
+void LSMMultiMap::startCompaction() {
+	if (compactor.joinable() || runs.size() < 2) return; //only one compaction at a time
+	std::vector<std::shared_ptr<Run> > inputs = runs;
+	compactionInputs = inputs.size();
+	compactionRunId = header.nextRunId++;
+	compactionDone = false;
+	std::string filename = runFilename(compactionRunId);
+	compactor = std::thread([this, inputs, filename]() {
+		compactionOk = compactRuns(inputs, filename);
+		compactionDone = true;
+	});
+}
+
+bool LSMMultiMap::compactRuns(std::vector<std::shared_ptr<Run> > inputs, std::string filename) {
+	//k-way merge of the input runs; inputs always include the oldest run, so tombstones can be dropped here
+	std::vector<std::unique_ptr<RunReader> > readers;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		readers.push_back(std::unique_ptr<RunReader>(new RunReader));
+		if (!readers.back()->open(*inputs[i])) return false;
+	}
+	RunWriter writer;
+	if (!writer.open(filename)) return false;
+	std::vector<Entry> group;
+	for (;;) {
+		const std::string* minKey = nullptr;
+		for (size_t i = 0; i < readers.size(); i++) {
+			if (readers[i]->isValid() && (!minKey || readers[i]->current().key < *minKey)) minKey = &readers[i]->current().key;
+		}
+		if (!minKey) break;
+		std::string key = *minKey;
+		group.clear();
+		for (size_t i = 0; i < readers.size(); i++) {
+			while (readers[i]->isValid() && readers[i]->current().key == key) {
+				group.push_back(readers[i]->current());
+				readers[i]->next();
+			}
+		}
+		std::stable_sort(group.begin(), group.end(), [](const Entry& a, const Entry& b) { return a.data.seq < b.data.seq; });
+		applyTombstones(group);
+		for (size_t i = 0; i < group.size(); i++) {
+			if (!writer.append(group[i])) return false;
+		}
+	}
+	return writer.finish();
+}
+
+void LSMMultiMap::finishCompaction(bool wait) {
+	if (!compactor.joinable() || (!wait && !compactionDone)) return;
+	compactor.join();
+	std::shared_ptr<Run> merged;
+	if (compactionOk) merged = openRun(compactionRunId);
+	if (!merged) {
+		std::remove(runFilename(compactionRunId).c_str()); //failed compaction leaves the old runs in place
+		return;
+	}
+	//runs flushed while the compaction was running are newer than everything in it, so they stay after it
+	std::vector<std::shared_ptr<Run> > old(runs.begin(), runs.begin() + compactionInputs);
+	runs.erase(runs.begin(), runs.begin() + compactionInputs);
+	runs.insert(runs.begin(), merged);
+	writeManifest();
+	STATS_ADD(m_stats.compactions, 1);
+	for (size_t i = 0; i < old.size(); i++) {
+#ifndef CYBERSPIDER_NO_STATS
+		retiredIo.merge(old[i]->file.ioStats());
+#endif
+		old[i]->file.close();
+		std::remove(old[i]->filename.c_str());
+	}
+}
+
+void LSMMultiMap::compact() {
+	if (!bf.isOpen()) return;
+	finishCompaction(true);
+	flush();
+	finishCompaction(true);
+	startCompaction();
+	finishCompaction(true);
+}
+
+Stats LSMMultiMap::stats() const {
+	Stats s = m_stats;
+	s.io = bf.ioStats();
+	s.io.merge(retiredIo);
+	for (size_t i = 0; i < runs.size(); i++) s.io.merge(runs[i]->file.ioStats());
+	return s;
+}
@@ -0,0 +1,151 @@
+#ifndef LSMMULTIMAP_H_
+#define LSMMULTIMAP_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include "MultiMapTuple.h"
+#include "BinaryFile.h"
+#include "Stats.h"
+#include "ValueFilter.h"
+
+//write-optimized alternative to DiskMultiMap with the same insert/search/erase/Iterator interface
+//inserts go to an in-memory memtable which is flushed as a sorted immutable run, so ingest only does sequential writes
+//unlike DiskMultiMap, which writes every insert and erase into its file straight away, the memtable has no write-ahead log: whatever
+//was inserted or erased since the last flush is lost if the process exits without close() (or flush())
+class LSMMultiMap {
+private:
+	//structs are defined before rest of class
+	struct MemEntry {
+		std::string value, context;
+		uint32_t seq; //global insertion order, used to order values and apply tombstones
+		uint8_t tombstone; //LIVE, or a tombstone for the values inserted before it
+	};
+	enum Tombstone {
+		LIVE,
+		VALUE_TOMBSTONE, //erase: removes the key's earlier values equal to this one
+		KEY_TOMBSTONE //eraseKey: removes all the key's earlier values
+	};
+	struct Entry {
+		std::string key;
+		MemEntry data;
+	};
+	struct ManifestHeader {
+		uint32_t magic;
+		uint32_t memtableLimit;
+		uint32_t nextSeq, nextRunId;
+		uint32_t numRuns; //followed by numRuns run ids (oldest first)
+	};
+	struct RunHeader {
+		uint32_t magic;
+		uint32_t numEntries;
+		BinaryFile::Offset indexOffset; //records occupy [sizeof(RunHeader), indexOffset)
+		uint32_t numIndexEntries;
+	};
+	struct RecordHeader {
+		uint32_t seq;
+		uint8_t tombstone, klen, vlen, clen; //followed by the key, value and context bytes
+	};
+	struct Run {
+		uint32_t id;
+		std::string filename;
+		BinaryFile file;
+		BinaryFile::Offset indexOffset;
+		std::vector<std::string> indexKeys; //sparse index: first key of every block of INDEX_INTERVAL records
+		std::vector<BinaryFile::Offset> indexOffsets;
+	};
+	class RunWriter {
+	public:
+		bool open(const std::string& filename);
+		bool append(const Entry& e);
+		bool finish();
+		const IoStats& ioStats() const { return file.ioStats(); }
+	private:
+		bool flushBuffer();
+		BinaryFile file;
+		BinaryFile::Offset pos;
+		uint32_t count;
+		std::string buffer; //records are batched so each write call is a large sequential write
+		std::vector<std::string> indexKeys;
+		std::vector<BinaryFile::Offset> indexOffsets;
+	};
+	class RunReader {
+	public:
+		bool open(const Run& run);
+		bool isValid() const { return m_pos < m_block.size(); }
+		const Entry& current() const { return m_block[m_pos]; }
+		void next();
+	private:
+		bool loadBlock();
+		BinaryFile file; //separate handle so the compaction thread never touches a stream used by search
+		std::vector<BinaryFile::Offset> blockStarts;
+		size_t nextBlock;
+		std::vector<Entry> m_block;
+		size_t m_pos;
+	};
+public:
+	class Iterator {
+	public:
+		Iterator();
+		Iterator(const std::shared_ptr<std::vector<MultiMapTuple> >& tuples);
+		bool isValid() const;
+		Iterator& operator++();
+		MultiMapTuple operator*();
+		bool matches(const ValueFilter& filter) const; //whether the current value passes filter, without copying it out
+	private:
+		std::shared_ptr<std::vector<MultiMapTuple> > m_tuples; //search merges every run up front, so the iterator just walks the result
+		size_t m_pos;
+	};
+
+	LSMMultiMap();
+	~LSMMultiMap();
+	bool createNew(const std::string& filename, unsigned int memtableLimit);
+	bool openExisting(const std::string& filename);
+	void close();
+	bool insert(const std::string& key, const std::string& value, const std::string& context);
+	Iterator search(const std::string& key);
+	int erase(const std::string& key, const std::string& value, const std::string& context); //searches the key to count what it removes
+	bool eraseKey(const std::string& key); //removes all of key's values with one tombstone, without reading them
+	bool flush(); //writes the memtable out as a new run
+	void compact(); //merges every run into one and waits for it to finish
+	Stats stats() const; //counters since this LSMMultiMap was constructed (compaction I/O on the background thread isn't counted)
+
+private:
+	static const uint32_t MANIFEST_MAGIC = 0x4c534d31; //"LSM1"
+	static const uint32_t RUN_MAGIC = 0x52554e31; //"RUN1"
+	static const unsigned int INDEX_INTERVAL = 32; //records per sparse index entry
+	static const unsigned int COMPACTION_TRIGGER = 4; //number of runs that starts a background compaction
+
+	std::string runFilename(uint32_t id) const;
+	bool writeManifest();
+	std::shared_ptr<Run> openRun(uint32_t id);
+	static bool readBlock(BinaryFile& file, BinaryFile::Offset from, BinaryFile::Offset to, std::vector<Entry>& entries);
+	void searchRun(Run& run, const std::string& key, std::vector<Entry>& found);
+	static void applyTombstones(std::vector<Entry>& entries);
+	void startCompaction();
+	static bool compactRuns(std::vector<std::shared_ptr<Run> > inputs, std::string filename);
+	void finishCompaction(bool wait);
+
+	BinaryFile bf; //manifest
+	std::string m_filename;
+	ManifestHeader header;
+	std::map<std::string, std::vector<MemEntry> > memtable;
+	unsigned int memtableSize;
+
+	std::vector<std::shared_ptr<Run> > runs; //oldest first
+	//the compaction thread only reads its input runs and writes a new file; the result is installed by the owning thread
+	std::thread compactor;
+	std::atomic<bool> compactionDone;
+	bool compactionOk;
+	size_t compactionInputs;
+	uint32_t compactionRunId;
+
+	Stats m_stats;
+	IoStats retiredIo; //I/O of runs that have since been compacted away
+};
+
+#endif // LSMMULTIMAP_H_
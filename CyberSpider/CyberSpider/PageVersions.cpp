@@ -0,0 +1,148 @@
+#include "PageVersions.h"
+#include "BinaryFile.h"
+#include <algorithm>
+#include <cstring>
+
+PageVersions::PageVersions() {
+	reset(0);
+}
+
+unsigned int PageVersions::addFile(BinaryFile* file) {
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_files.push_back(file);
+	m_lengths.push_back(file->fileLength());
+	return (unsigned int)(m_files.size() - 1);
+}
+
+void PageVersions::reset(uint32_t generation) {
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_files.clear();
+	m_lengths.clear();
+	m_copies.clear();
+	m_pinned.clear();
+	m_waiting = 0;
+	m_generation = generation;
+	m_open = m_copying = false;
+	m_counters.pagesCopied = m_counters.bytesHeld = m_counters.maxBytesHeld = m_counters.pins = m_counters.pinWaits = 0;
+}
+
+void PageVersions::beforeWrite(unsigned int file, int64_t offset, size_t length) {
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (!m_open) {
+		//whether this generation is copied is settled by its first write: a reader that turns up later without copies waits for the commit
+		m_open = true;
+		m_copying = !m_pinned.empty() || m_waiting > 0;
+	}
+	if (!m_copying || file >= m_files.size()) return;
+	int64_t end = std::min<int64_t>(offset + length, m_lengths[file]);
+	for (int64_t page = offset / PAGE_BYTES; page * PAGE_BYTES < end; page++) {
+		std::vector<Copy>& copies = m_copies[std::make_pair(file, page)];
+		if (!copies.empty() && copies.back().generation == m_generation) continue; //already copied this generation
+		//the page hasn't been written since the last commit, so the writer's own view of it is the committed one
+		Copy copy;
+		copy.generation = m_generation;
+		copy.bytes.resize((size_t)(std::min(page * PAGE_BYTES + PAGE_BYTES, m_lengths[file]) - page * PAGE_BYTES));
+		if (!m_files[file]->read(copy.bytes.data(), copy.bytes.size(), (int32_t)(page * PAGE_BYTES))) continue;
+		m_counters.pagesCopied++;
+		m_counters.bytesHeld += copy.bytes.size();
+		m_counters.maxBytesHeld = std::max(m_counters.maxBytesHeld, m_counters.bytesHeld);
+		copies.push_back(std::move(copy));
+	}
+}
+
+bool PageVersions::commit() {
+	//flushed before the generation is published, so a snapshot's reads of pages without copies find the committed bytes in the file
+	bool ok = true;
+	std::vector<int64_t> lengths;
+	for (size_t i = 0; i < m_files.size(); i++) {
+		ok = m_files[i]->flush() && ok;
+		lengths.push_back(m_files[i]->fileLength());
+	}
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_generation++;
+	m_lengths = lengths;
+	m_open = m_copying = false;
+	prune();
+	m_committed.notify_all();
+	return ok;
+}
+
+uint32_t PageVersions::generation() const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_generation;
+}
+bool PageVersions::written() const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_open;
+}
+bool PageVersions::hasReaders() const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return !m_pinned.empty() || m_waiting > 0;
+}
+uint32_t PageVersions::oldestPinned() const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_pinned.empty() ? NONE_PINNED : *m_pinned.begin();
+}
+
+uint32_t PageVersions::pin() {
+	std::unique_lock<std::mutex> lock(m_lock);
+	if (m_open && !m_copying) {
+		m_counters.pinWaits++;
+		m_waiting++;
+		m_committed.wait(lock, [this] { return !m_open || m_copying; });
+		m_waiting--;
+	}
+	m_pinned.insert(m_generation);
+	m_counters.pins++;
+	return m_generation;
+}
+void PageVersions::unpin(uint32_t generation) {
+	std::lock_guard<std::mutex> guard(m_lock);
+	std::multiset<uint32_t>::iterator it = m_pinned.find(generation);
+	if (it == m_pinned.end()) return;
+	m_pinned.erase(it);
+	prune();
+}
+
+void PageVersions::overlay(unsigned int file, uint32_t generation, int64_t offset, char* data, size_t length) const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (m_copies.empty()) return;
+	int64_t end = offset + (int64_t)length;
+	for (int64_t page = offset / PAGE_BYTES; page * PAGE_BYTES < end; page++) {
+		std::map<std::pair<unsigned int, int64_t>, std::vector<Copy> >::const_iterator it = m_copies.find(std::make_pair(file, page));
+		if (it == m_copies.end()) continue;
+		//the oldest copy made since generation: the page didn't change in between, and it has changed since
+		for (size_t i = 0; i < it->second.size(); i++) {
+			const Copy& copy = it->second[i];
+			if (copy.generation < generation) continue;
+			int64_t from = std::max(offset, page * PAGE_BYTES), to = std::min(end, page * PAGE_BYTES + (int64_t)copy.bytes.size());
+			if (from < to) memcpy(data + (from - offset), copy.bytes.data() + (from - page * PAGE_BYTES), (size_t)(to - from));
+			break;
+		}
+	}
+}
+
+PageVersions::Counters PageVersions::counters() const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_counters;
+}
+
+void PageVersions::prune() {
+	//a copy is only read by snapshots pinned after the page's previous copy, up to its own generation; new snapshots only get
+	//the latest generation, so a copy older than that with no snapshot in its range will never be read again
+	for (std::map<std::pair<unsigned int, int64_t>, std::vector<Copy> >::iterator it = m_copies.begin(); it != m_copies.end(); ) {
+		std::vector<Copy>& copies = it->second;
+		size_t kept = 0;
+		for (size_t i = 0; i < copies.size(); i++) {
+			std::multiset<uint32_t>::const_iterator reader = kept == 0 ? m_pinned.begin() : m_pinned.upper_bound(copies[kept - 1].generation);
+			if (copies[i].generation >= m_generation || (reader != m_pinned.end() && *reader <= copies[i].generation)) {
+				if (kept != i) copies[kept] = std::move(copies[i]);
+				kept++;
+			}
+			else m_counters.bytesHeld -= copies[i].bytes.size();
+		}
+		copies.resize(kept);
+		if (copies.empty()) it = m_copies.erase(it);
+		else ++it;
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef PAGEVERSIONS_H_
+#define PAGEVERSIONS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <set>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+
+class BinaryFile;
+
+//snapshots of files that one thread keeps writing in place (the DiskMultiMaps of an IntelWeb being ingested into), for readers on other threads
+//the writer commits generations, and a reader pins the latest committed generation and sees every file exactly as it was then
+//before the writer first overwrites a page in a generation, the page's committed bytes are copied here, and a snapshot's reads are patched
+//with the oldest copy made since its generation; so a reader never sees a half-written record, a relinked chain or a reused slot
+//copies are only made while snapshots are pinned, and are dropped once no pinned snapshot can need them
+class PageVersions {
+public:
+	static const int64_t PAGE_BYTES = 4096;
+	static const uint32_t NONE_PINNED = UINT32_MAX;
+	struct Counters {
+		uint64_t pagesCopied; //pages copied before the writer overwrote them
+		uint64_t bytesHeld, maxBytesHeld; //held in copies now, and at most
+		uint64_t pins, pinWaits; //snapshots pinned, and how many had to wait for a commit
+	};
+
+	PageVersions();
+	//writer side: only the thread that writes the files may call these
+	unsigned int addFile(BinaryFile* file); //index to give the file's BinaryFile::setVersions
+	void reset(uint32_t generation); //forgets the files and copies (no snapshot may be pinned)
+	void beforeWrite(unsigned int file, int64_t offset, size_t length); //called by BinaryFile::write before the bytes change
+	bool commit(); //flushes every file and makes what's been written since the last commit the next generation
+	uint32_t generation() const; //latest committed
+	bool written() const; //something has been written since the last commit, which a reader that pins now may wait for
+	uint32_t oldestPinned() const; //NONE_PINNED if no snapshot is pinned
+	bool hasReaders() const; //a snapshot is pinned or waiting in pin(), so the writer should commit now and then
+
+	//reader side: any thread
+	//the latest committed generation; if the writer is partway through a generation it isn't copying pages for, waits for it to commit
+	uint32_t pin();
+	void unpin(uint32_t generation);
+	void overlay(unsigned int file, uint32_t generation, int64_t offset, char* data, size_t length) const; //called by BinaryFile::read on a snapshot
+	Counters counters() const;
+
+private:
+	struct Copy {
+		uint32_t generation; //the page's bytes as of this generation (it changed in the next one)
+		std::vector<char> bytes; //up to the file's length at that generation
+	};
+	void prune();
+
+	mutable std::mutex m_lock;
+	std::condition_variable m_committed;
+	std::vector<BinaryFile*> m_files;
+	std::vector<int64_t> m_lengths; //each file's length at the last commit; pages past it aren't in any snapshot
+	std::map<std::pair<unsigned int, int64_t>, std::vector<Copy> > m_copies; //(file, page) -> its copies, oldest first
+	std::multiset<uint32_t> m_pinned;
+	unsigned int m_waiting; //readers waiting in pin()
+	uint32_t m_generation;
+	bool m_open; //written since the last commit
+	bool m_copying; //pages are being copied for the open generation
+	Counters m_counters;
+};
+
+#endif // PAGEVERSIONS_H_
@@ -0,0 +1,124 @@
+#include "PrevalenceReport.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+static const size_t PRINT_HUBS = 20;
+
+//the heap keeps its least prevalent candidate at the front, to be replaced by a more prevalent one
+static bool morePrevalent(const PrevalenceReport::Candidate& a, const PrevalenceReport::Candidate& b) {
+	if (a.prevalence != b.prevalence) return a.prevalence > b.prevalence;
+	return a.file != b.file ? a.file < b.file : a.keyTuple < b.keyTuple; //ties in a fixed order, so the same database gives the same hubs
+}
+
+PrevalenceReport::PrevalenceReport() {
+}
+
+void PrevalenceReport::clear() {
+	m_prevalence.clear();
+	m_candidates.clear();
+	m_hubs.clear();
+	m_known.clear();
+}
+
+void PrevalenceReport::addCandidate(const Candidate& candidate, size_t topK) {
+	if (m_candidates.size() < topK) {
+		m_candidates.push_back(candidate);
+		std::push_heap(m_candidates.begin(), m_candidates.end(), morePrevalent);
+	} else if (topK > 0 && morePrevalent(candidate, m_candidates.front())) {
+		std::pop_heap(m_candidates.begin(), m_candidates.end(), morePrevalent);
+		m_candidates.back() = candidate;
+		std::push_heap(m_candidates.begin(), m_candidates.end(), morePrevalent);
+	}
+}
+
+void PrevalenceReport::addShard(std::vector<KeyCount>& initiators, std::vector<KeyCount>& targets, unsigned int initiatorFile, unsigned int targetFile, size_t topK) {
+	auto byHash = [](const KeyCount& a, const KeyCount& b) { return a.hash < b.hash; };
+	std::sort(initiators.begin(), initiators.end(), byHash);
+	std::sort(targets.begin(), targets.end(), byHash);
+	std::make_heap(m_candidates.begin(), m_candidates.end(), morePrevalent);
+	//an entity is a key in one file or both; two different names with the same 64-bit hash would be counted as one entity
+	size_t i = 0, t = 0;
+	while (i < initiators.size() || t < targets.size()) {
+		Candidate c;
+		if (t == targets.size() || (i < initiators.size() && initiators[i].hash < targets[t].hash)) {
+			c.prevalence = initiators[i].values;
+			c.file = initiatorFile;
+			c.keyTuple = initiators[i++].keyTuple;
+		} else if (i == initiators.size() || targets[t].hash < initiators[i].hash) {
+			c.prevalence = targets[t].values;
+			c.file = targetFile;
+			c.keyTuple = targets[t++].keyTuple;
+		} else {
+			c.prevalence = initiators[i].values + targets[t++].values;
+			c.file = initiatorFile;
+			c.keyTuple = initiators[i++].keyTuple;
+		}
+		m_prevalence.add(c.prevalence);
+		addCandidate(c, topK);
+	}
+	std::sort(m_candidates.begin(), m_candidates.end(), morePrevalent);
+}
+
+void PrevalenceReport::merge(const PrevalenceReport& other, size_t topK) {
+	m_prevalence.merge(other.m_prevalence);
+	m_candidates.insert(m_candidates.end(), other.m_candidates.begin(), other.m_candidates.end());
+	std::sort(m_candidates.begin(), m_candidates.end(), morePrevalent);
+	if (m_candidates.size() > topK) m_candidates.resize(topK);
+}
+
+void PrevalenceReport::addHub(const std::string& entity, unsigned int prevalence) {
+	Hub hub;
+	hub.entity = entity;
+	hub.prevalence = prevalence;
+	m_hubs.push_back(hub);
+	m_known[entity] = prevalence;
+}
+
+void PrevalenceReport::sortHubs() {
+	std::sort(m_hubs.begin(), m_hubs.end(), [](const Hub& a, const Hub& b) {
+		return a.prevalence != b.prevalence ? a.prevalence > b.prevalence : a.entity < b.entity;
+	});
+}
+
+bool PrevalenceReport::write(const std::string& filename) const {
+	std::ofstream outf(filename);
+	for (size_t i = 0; i < m_hubs.size(); i++)
+		outf << m_hubs[i].prevalence << ' ' << m_hubs[i].entity << '\n';
+	return outf.good();
+}
+
+bool PrevalenceReport::load(const std::string& filename) {
+	clear();
+	std::ifstream inf(filename);
+	if (!inf) return false;
+	std::string line;
+	while (getline(inf, line)) {
+		std::istringstream iss(line);
+		unsigned int prevalence;
+		std::string entity;
+		if (!(iss >> prevalence)) {
+			if (line.find_first_not_of(" \t\r") == std::string::npos) continue; //blank line
+			return false;
+		}
+		if (!(iss >> entity)) return false;
+		addHub(entity, prevalence);
+	}
+	return true;
+}
+
+void PrevalenceReport::print(std::ostream& out) const {
+	out << "entities: " << m_prevalence.count << std::endl;
+	m_prevalence.print(out, "prevalence per entity");
+	//an entity with at least minPrevalenceToBeGood associations is skipped by crawl, so these are the shares each power of two would skip
+	out << "minPrevalenceToBeGood: entities at or above it" << std::endl;
+	uint64_t atOrAbove = m_prevalence.count;
+	for (int i = 1; i < Histogram::NUM_BUCKETS && atOrAbove > 0; i++) {
+		atOrAbove -= m_prevalence.buckets[i - 1];
+		if (atOrAbove == 0) break;
+		out << "  " << (uint64_t(1) << (i - 1)) << ": " << atOrAbove << " (" << 100.0*atOrAbove / m_prevalence.count << "%)" << std::endl;
+	}
+	out << "top hubs:" << std::endl;
+	for (size_t i = 0; i < m_hubs.size() && i < PRINT_HUBS; i++)
+		out << "  " << m_hubs[i].prevalence << " " << m_hubs[i].entity << std::endl;
+}
@@ -0,0 +1,67 @@
+#ifndef PREVALENCEREPORT_H_
+#define PREVALENCEREPORT_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include "BinaryFile.h"
+#include "Stats.h"
+
+//how many associations each entity of a database has as an initiator plus as a target: the prevalence crawl compares with minPrevalenceToBeGood
+//IntelWeb::reportPrevalence builds it from one sequential scan of each .dmm file instead of a search per entity
+//the hubs (the most prevalent entities) can be written out and loaded back into crawl as a known-good set, so crawl skips searching them
+class PrevalenceReport {
+public:
+	struct Hub {
+		std::string entity;
+		unsigned int prevalence;
+	};
+	//one live key of a scanned .dmm file (see DiskMultiMap::KeyVisitor)
+	struct KeyCount {
+		uint64_t hash;
+		BinaryFile::Offset keyTuple;
+		unsigned int values;
+	};
+	//a hub before its name is read: which file's KeyTuple has it (either of the entity's files has its name)
+	struct Candidate {
+		unsigned int prevalence;
+		unsigned int file;
+		BinaryFile::Offset keyTuple;
+	};
+
+	PrevalenceReport();
+	void clear();
+	//adds one shard's entities: an entity's initiator and target keys are in the same shard, so sorting both files' keys by hash and merging them
+	//gives every entity's prevalence without a table of all the entities. Keeps the topK most prevalent as candidates. Sorts both vectors
+	void addShard(std::vector<KeyCount>& initiators, std::vector<KeyCount>& targets, unsigned int initiatorFile, unsigned int targetFile, size_t topK);
+	void merge(const PrevalenceReport& other, size_t topK); //other's entities are distinct from this one's (another shard)
+	const std::vector<Candidate>& candidates() const { return m_candidates; } //most prevalent first
+	void addHub(const std::string& entity, unsigned int prevalence); //once the candidates' names are read
+	void sortHubs(); //most prevalent first, ties by name
+
+	uint64_t entities() const { return m_prevalence.count; }
+	const Histogram& histogram() const { return m_prevalence; } //entities per prevalence
+	const std::vector<Hub>& hubs() const { return m_hubs; } //most prevalent first
+	//for crawl: an entity's prevalence if it's a hub, otherwise 0 (not known, rather than not prevalent)
+	unsigned int prevalence(const std::string& entity) const {
+		std::unordered_map<std::string, unsigned int>::const_iterator it = m_known.find(entity);
+		return it == m_known.end() ? 0 : it->second;
+	}
+
+	bool write(const std::string& filename) const; //the hubs, one "prevalence entity" line each
+	bool load(const std::string& filename); //what write wrote; false if a line isn't a prevalence and an entity
+	void print(std::ostream& out) const;
+
+private:
+	void addCandidate(const Candidate& candidate, size_t topK);
+
+	Histogram m_prevalence;
+	std::vector<Candidate> m_candidates; //a min-heap on prevalence until addShard and merge return, then sorted most first
+	std::vector<Hub> m_hubs;
+	std::unordered_map<std::string, unsigned int> m_known; //the hubs, by name
+};
+
+#endif // PREVALENCEREPORT_H_
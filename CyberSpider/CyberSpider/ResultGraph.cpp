@@ -0,0 +1,302 @@
+#include "ResultGraph.h"
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+static const char HTTP_PREFIX[] = "http://";
+static const size_t HTTP_PREFIX_LENGTH = sizeof(HTTP_PREFIX) - 1;
+static const size_t FLUSH_BYTES = 1 << 16;
+static const char* COLOR_NAMES[ResultGraph::COLORS] = { "red", "orange", "green" };
+static const char* OTHER_NAMES[ResultGraph::COLORS] = { "more bad files", "more bad URLs", "more good entities" };
+
+static bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+//up to maxTokens whitespace-separated tokens of line, returning how many there are (counting at most maxTokens)
+static size_t split(const std::string& line, const char** tokens, size_t* lengths, size_t maxTokens) {
+	const char* p = line.data();
+	const char* end = p + line.size();
+	size_t found = 0;
+	while (found < maxTokens) {
+		while (p < end && isSpace(*p)) p++;
+		if (p == end) break;
+		tokens[found] = p;
+		while (p < end && !isSpace(*p)) p++;
+		lengths[found] = p - tokens[found];
+		found++;
+	}
+	return found;
+}
+
+//a name as a JSON string; '<' is escaped too, so a name can't close the page's <script>
+static void appendJsonString(std::string& out, const std::string& s) {
+	out += '"';
+	for (size_t i = 0; i < s.size(); i++) {
+		unsigned char c = (unsigned char)s[i];
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += s[i];
+		} else if (c < 0x20 || c == '<') {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out += escaped;
+		} else out += s[i];
+	}
+	out += '"';
+}
+
+template<typename T>
+static void writeRaw(std::ostream& out, T value) {
+	out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+ResultGraph::ResultGraph() {
+}
+
+const char* ResultGraph::colorName(Color color) {
+	return COLOR_NAMES[color];
+}
+
+bool ResultGraph::load(const std::string& resultsFile) {
+	std::ifstream inf(resultsFile);
+	if (!inf) return false;
+	m_nodes.clear();
+	m_edges.clear();
+	//the bad entities come first, so every node's color is known when it's added
+	std::string line, machine, from, to;
+	const char* tokens[4];
+	size_t lengths[4];
+	while (getline(inf, line)) {
+		size_t found = split(line, tokens, lengths, 4);
+		if (found == 1) m_bad.insert(std::string(tokens[0], lengths[0]));
+		else if (found == 3) {
+			machine.assign(tokens[0], lengths[0]);
+			from.assign(tokens[1], lengths[1]);
+			to.assign(tokens[2], lengths[2]);
+			Edge edge;
+			edge.from = node(from, machine);
+			edge.to = node(to, machine);
+			edge.weight = 1;
+			m_edges.push_back(edge);
+		}
+	}
+	std::unordered_map<std::string, uint32_t>().swap(m_ids);
+	std::unordered_set<std::string>().swap(m_bad);
+	countDegrees();
+	return true;
+}
+
+uint32_t ResultGraph::node(const std::string& entity, const std::string& machine) {
+	bool url = entity.compare(0, HTTP_PREFIX_LENGTH, HTTP_PREFIX) == 0;
+	m_key = entity;
+	if (!url) {
+		m_key += " (";
+		m_key += machine;
+		m_key += ')';
+	}
+	std::unordered_map<std::string, uint32_t>::const_iterator it = m_ids.find(m_key);
+	if (it != m_ids.end()) return it->second;
+	Node n;
+	n.name = m_key;
+	if (!url) n.machine = machine;
+	n.color = !m_bad.count(entity) ? GOOD : url ? BAD_URL : BAD_FILE;
+	n.weight = 1;
+	n.degree = 0;
+	uint32_t id = (uint32_t)m_nodes.size();
+	m_ids.insert(std::make_pair(m_key, id));
+	m_nodes.push_back(n);
+	return id;
+}
+
+void ResultGraph::countDegrees() {
+	for (size_t i = 0; i < m_nodes.size(); i++) m_nodes[i].degree = 0;
+	for (size_t i = 0; i < m_edges.size(); i++) {
+		m_nodes[m_edges[i].from].degree += m_edges[i].weight;
+		m_nodes[m_edges[i].to].degree += m_edges[i].weight;
+	}
+}
+
+void ResultGraph::reduce(size_t maxNodes, Reduction reduction) {
+	if (reduction == BY_MACHINE) collapseMachines();
+	collapseToTop(maxNodes);
+}
+
+void ResultGraph::remap(const std::vector<uint32_t>& nodeMap, std::vector<Node>& merged) {
+	size_t kept = 0;
+	for (size_t i = 0; i < m_edges.size(); i++) {
+		Edge edge = m_edges[i];
+		edge.from = nodeMap[edge.from];
+		edge.to = nodeMap[edge.to];
+		if (edge.from != edge.to) m_edges[kept++] = edge;
+	}
+	m_edges.resize(kept);
+	//edges between the same pair of nodes become one, weighted by how many there were
+	std::sort(m_edges.begin(), m_edges.end(), [](const Edge& a, const Edge& b) {
+		return a.from != b.from ? a.from < b.from : a.to < b.to;
+	});
+	kept = 0;
+	for (size_t i = 0; i < m_edges.size(); i++) {
+		if (kept > 0 && m_edges[kept - 1].from == m_edges[i].from && m_edges[kept - 1].to == m_edges[i].to)
+			m_edges[kept - 1].weight += m_edges[i].weight;
+		else m_edges[kept++] = m_edges[i];
+	}
+	m_edges.resize(kept);
+	m_nodes.swap(merged);
+	countDegrees();
+}
+
+void ResultGraph::collapseMachines() {
+	std::vector<uint32_t> nodeMap(m_nodes.size());
+	std::vector<Node> merged;
+	std::unordered_map<std::string, uint32_t> machines;
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		Node& n = m_nodes[i];
+		if (n.machine.empty()) { //URLs aren't tied to a machine
+			nodeMap[i] = (uint32_t)merged.size();
+			merged.push_back(n);
+			continue;
+		}
+		std::unordered_map<std::string, uint32_t>::iterator it = machines.find(n.machine);
+		if (it == machines.end()) {
+			Node cluster;
+			cluster.machine = n.machine;
+			cluster.color = GOOD;
+			cluster.weight = 0;
+			cluster.degree = 0;
+			it = machines.insert(std::make_pair(n.machine, (uint32_t)merged.size())).first;
+			merged.push_back(cluster);
+		}
+		Node& cluster = merged[it->second];
+		if (n.color == BAD_FILE) cluster.color = BAD_FILE; //a machine with any bad file on it is bad
+		cluster.weight += n.weight;
+		nodeMap[i] = it->second;
+	}
+	for (size_t i = 0; i < merged.size(); i++)
+		if (!merged[i].machine.empty()) merged[i].name = merged[i].machine + " (" + std::to_string(merged[i].weight) + " files)";
+	remap(nodeMap, merged);
+}
+
+void ResultGraph::collapseToTop(size_t maxNodes) {
+	if (maxNodes == 0 || m_nodes.size() <= maxNodes) return;
+	//most interactions first, ties in the order the nodes were seen
+	std::vector<uint32_t> order(m_nodes.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = (uint32_t)i;
+	std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return m_nodes[a].degree > m_nodes[b].degree; });
+	//the collapsed nodes (one per color left out) count towards maxNodes too
+	size_t kept = maxNodes;
+	for (;;) {
+		bool dropped[COLORS] = { false, false, false };
+		size_t groups = 0;
+		for (size_t i = kept; i < order.size(); i++) {
+			if (!dropped[m_nodes[order[i]].color]) groups++;
+			dropped[m_nodes[order[i]].color] = true;
+		}
+		if (kept + groups <= maxNodes || kept == 0) break;
+		kept--;
+	}
+	std::vector<bool> keep(m_nodes.size(), false);
+	for (size_t i = 0; i < kept; i++) keep[order[i]] = true;
+
+	std::vector<uint32_t> nodeMap(m_nodes.size());
+	std::vector<Node> merged;
+	int others[COLORS] = { -1, -1, -1 };
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		if (keep[i]) {
+			nodeMap[i] = (uint32_t)merged.size();
+			merged.push_back(m_nodes[i]);
+		}
+	}
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		if (keep[i]) continue;
+		Color color = m_nodes[i].color;
+		if (others[color] == -1) {
+			Node other;
+			other.color = color;
+			other.weight = 0;
+			other.degree = 0;
+			others[color] = (int)merged.size();
+			merged.push_back(other);
+		}
+		merged[others[color]].weight += m_nodes[i].weight;
+		nodeMap[i] = (uint32_t)others[color];
+	}
+	for (int c = 0; c < COLORS; c++)
+		if (others[c] != -1) merged[others[c]].name = "(" + std::to_string(merged[others[c]].weight) + " " + OTHER_NAMES[c] + ")";
+	remap(nodeMap, merged);
+}
+
+bool ResultGraph::writeJson(std::ostream& out) const {
+	//built up in a buffer and written out every FLUSH_BYTES, so the output is never held whole
+	std::string buffer = "{\"colors\":[";
+	for (int c = 0; c < COLORS; c++) {
+		if (c > 0) buffer += ',';
+		buffer += '"';
+		buffer += COLOR_NAMES[c];
+		buffer += '"';
+	}
+	buffer += "],\n\"nodes\":[";
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		if (i > 0) buffer += ",\n";
+		buffer += '[';
+		appendJsonString(buffer, m_nodes[i].name);
+		buffer += ',';
+		buffer += std::to_string((int)m_nodes[i].color);
+		buffer += ',';
+		buffer += std::to_string(m_nodes[i].weight);
+		buffer += ']';
+		if (buffer.size() >= FLUSH_BYTES) {
+			out.write(buffer.data(), buffer.size());
+			buffer.clear();
+		}
+	}
+	buffer += "],\n\"links\":[";
+	for (size_t i = 0; i < m_edges.size(); i++) {
+		if (i > 0) buffer += (i % 16 == 0) ? ",\n" : ",";
+		buffer += std::to_string(m_edges[i].from);
+		buffer += ',';
+		buffer += std::to_string(m_edges[i].to);
+		buffer += ',';
+		buffer += std::to_string(m_edges[i].weight);
+		if (buffer.size() >= FLUSH_BYTES) {
+			out.write(buffer.data(), buffer.size());
+			buffer.clear();
+		}
+	}
+	buffer += "]}";
+	out.write(buffer.data(), buffer.size());
+	return out.good();
+}
+
+bool ResultGraph::writeBinary(std::ostream& out) const {
+	writeRaw(out, BINARY_MAGIC);
+	writeRaw(out, (uint32_t)m_nodes.size());
+	writeRaw(out, (uint32_t)m_edges.size());
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		uint16_t length = (uint16_t)std::min<size_t>(m_nodes[i].name.size(), UINT16_MAX);
+		writeRaw(out, (uint8_t)m_nodes[i].color);
+		writeRaw(out, m_nodes[i].weight);
+		writeRaw(out, length);
+		out.write(m_nodes[i].name.data(), length);
+	}
+	for (size_t i = 0; i < m_edges.size(); i++) {
+		writeRaw(out, m_edges[i].from);
+		writeRaw(out, m_edges[i].to);
+		writeRaw(out, m_edges[i].weight);
+	}
+	return out.good();
+}
+
+bool ResultGraph::writeHtml(std::istream& page, std::ostream& out) const {
+	const std::string PLACEHOLDER = "<PLACEHOLDER/>";
+	std::string line;
+	while (getline(page, line)) {
+		if (line.find(PLACEHOLDER) == std::string::npos) out << line << '\n';
+		else {
+			out << "var graph = ";
+			writeJson(out);
+			out << ";\n";
+		}
+	}
+	return out.good();
+}
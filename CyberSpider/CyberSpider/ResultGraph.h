@@ -0,0 +1,68 @@
+#ifndef RESULTGRAPH_H_
+#define RESULTGRAPH_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <istream>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+//the graph of a crawl's results file (bad entities, a blank line, then "machine from to" interactions), for p4tester -w and -e
+//nodes get integer ids in the order they're first seen and edges are pairs of ids, so a big crawl costs a few words per interaction
+//a file is one node per machine it was seen on ("name (machine)"), a URL one node overall, as the original graph drew them
+//reduce() collapses nodes (by machine, and/or all but the best connected) so that a large outbreak still renders
+class ResultGraph {
+public:
+	enum Color { BAD_FILE, BAD_URL, GOOD, COLORS }; //red, orange and green in the page
+	enum Reduction {
+		TOP_DEGREE, //keep the nodes with the most interactions, and collapse the rest into one node per color
+		BY_MACHINE //first collapse each machine's files into one node (URLs stay as they are), then TOP_DEGREE if that's still too many
+	};
+	struct Node {
+		std::string name;
+		std::string machine; //empty for a URL
+		Color color;
+		uint32_t weight; //nodes of the results collapsed into this one
+		uint64_t degree; //interactions it takes part in
+	};
+	struct Edge {
+		uint32_t from, to;
+		uint32_t weight; //interactions collapsed into this edge
+	};
+	static const uint32_t BINARY_MAGIC = 0xC5612A01;
+
+	ResultGraph();
+	//reads the results a line at a time, without keeping the lines; false if the file can't be read
+	bool load(const std::string& resultsFile);
+	void reduce(size_t maxNodes, Reduction reduction); //maxNodes 0 is no limit (BY_MACHINE still collapses machines)
+	const std::vector<Node>& nodes() const { return m_nodes; }
+	const std::vector<Edge>& edges() const { return m_edges; }
+	static const char* colorName(Color color);
+
+	//{"colors":[...],"nodes":[[name,color,weight],...],"links":[from,to,weight,...]} with colors and nodes referred to by index
+	bool writeJson(std::ostream& out) const;
+	//header (BINARY_MAGIC, node count, edge count as uint32s), then each node as color (uint8), weight (uint32), name length (uint16)
+	//and name, then each edge as from, to and weight (uint32s)
+	bool writeBinary(std::ostream& out) const;
+	//the page template with its <PLACEHOLDER/> line replaced by "var graph = " and the JSON
+	bool writeHtml(std::istream& page, std::ostream& out) const;
+
+private:
+	uint32_t node(const std::string& entity, const std::string& machine);
+	void countDegrees();
+	//replaces the nodes with merged (nodeMap[old id] is the new id) and merges the edges the same way, dropping ones inside a node
+	void remap(const std::vector<uint32_t>& nodeMap, std::vector<Node>& merged);
+	void collapseMachines();
+	void collapseToTop(size_t maxNodes);
+
+	std::vector<Node> m_nodes;
+	std::vector<Edge> m_edges;
+	std::unordered_map<std::string, uint32_t> m_ids; //only while loading
+	std::unordered_set<std::string> m_bad; //bad entities; only while loading
+	std::string m_key; //reused to look nodes up
+};
+
+#endif // RESULTGRAPH_H_
@@ -0,0 +1,91 @@
+#include "ShardedMultiMap.h"
+#include <algorithm>
+
+ShardedMultiMap::ShardedMultiMap() {
+	m_hashFunction = DEFAULT_HASH_FUNCTION;
+	m_hasher = keyHasher(DEFAULT_HASH_FUNCTION);
+}
+
+bool ShardedMultiMap::createNew(const std::vector<std::string>& filenames, unsigned int numBuckets, HashFunction hashFunction, DiskMultiMap::Layout layout) {
+	close();
+	for (size_t i = 0; i < filenames.size(); i++) {
+		m_shards.push_back(std::unique_ptr<DiskMultiMap>(new DiskMultiMap));
+		if (!m_shards.back()->createNew(filenames[i], numBuckets, hashFunction, layout)) {
+			close();
+			return false;
+		}
+	}
+	m_hashFunction = hashFunction;
+	m_hasher = keyHasher(hashFunction);
+	return isOpen();
+}
+
+bool ShardedMultiMap::openExisting(const std::vector<std::string>& filenames) {
+	close();
+	for (size_t i = 0; i < filenames.size(); i++) {
+		m_shards.push_back(std::unique_ptr<DiskMultiMap>(new DiskMultiMap));
+		if (!m_shards.back()->openExisting(filenames[i]) || m_shards.back()->hashFunction() != m_shards[0]->hashFunction() ||
+			m_shards.back()->layout() != m_shards[0]->layout()) {
+			close();
+			return false;
+		}
+	}
+	if (!isOpen()) return false;
+	m_hashFunction = m_shards[0]->hashFunction();
+	m_hasher = keyHasher(m_hashFunction);
+	return true;
+}
+
+bool ShardedMultiMap::openSnapshot(const ShardedMultiMap& source, uint32_t generation) {
+	close();
+	for (size_t i = 0; i < source.m_shards.size(); i++) {
+		m_shards.push_back(std::unique_ptr<DiskMultiMap>(new DiskMultiMap));
+		if (!m_shards.back()->openSnapshot(*source.m_shards[i], generation)) {
+			close();
+			return false;
+		}
+	}
+	m_hashFunction = source.m_hashFunction;
+	m_hasher = source.m_hasher;
+	return isOpen();
+}
+
+void ShardedMultiMap::close() {
+	m_shards.clear(); //each DiskMultiMap closes its file as it's destroyed
+}
+
+void ShardedMultiMap::setVersions(PageVersions* versions) {
+	for (size_t i = 0; i < m_shards.size(); i++) m_shards[i]->setVersions(versions);
+}
+
+bool ShardedMultiMap::setGeneration(uint32_t generation, bool write) {
+	bool ok = true;
+	for (size_t i = 0; i < m_shards.size(); i++) ok = m_shards[i]->setGeneration(generation, write) && ok;
+	return ok;
+}
+
+uint32_t ShardedMultiMap::generation() const {
+	uint32_t latest = 0;
+	for (size_t i = 0; i < m_shards.size(); i++) latest = std::max(latest, m_shards[i]->generation());
+	return latest;
+}
+
+bool ShardedMultiMap::flush() {
+	bool ok = true;
+	for (size_t i = 0; i < m_shards.size(); i++) ok = m_shards[i]->flush() && ok;
+	return ok;
+}
+
+unsigned int ShardedMultiMap::shardOf(const std::string& key) const {
+	if (m_shards.size() <= 1) return 0;
+	//the hash's own bits already pick the bucket (low bits) and the PAGED fingerprint (high 32), so the shard comes from a multiplicative
+	//mix of all of them; hash % shards would leave every shard using only the buckets congruent to it whenever the bucket count shares a factor
+	uint64_t mixed = m_hasher(key.data(), key.size()) * 0x9E3779B97F4A7C15ULL;
+	return (unsigned int)((mixed >> 32) % m_shards.size());
+}
+
+Stats ShardedMultiMap::stats() const {
+	Stats s;
+	for (size_t i = 0; i < m_shards.size(); i++) s.merge(m_shards[i]->stats());
+	return s;
+}
@@ -0,0 +1,55 @@
+#ifndef SHARDEDMULTIMAP_H_
+#define SHARDEDMULTIMAP_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "DiskMultiMap.h"
+#include "KeyHash.h"
+#include "PageVersions.h"
+#include "Stats.h"
+
+//a DiskMultiMap split by key across several files, which can sit on different disks (IntelWeb's sharded databases)
+//every key lives in one shard, picked from its hash, so a key's whole value list is in one file and a search reads only that file
+//the shards are ordinary DiskMultiMaps and can be written from different threads at once, as long as each shard has one writer
+//one shard is just a DiskMultiMap
+class ShardedMultiMap {
+public:
+	typedef DiskMultiMap::Iterator Iterator;
+
+	ShardedMultiMap();
+	//numBuckets is per shard; every shard gets the same hash function and layout
+	bool createNew(const std::vector<std::string>& filenames, unsigned int numBuckets, HashFunction hashFunction = DEFAULT_HASH_FUNCTION, DiskMultiMap::Layout layout = DiskMultiMap::CHAINED);
+	//false if a shard can't be opened or the shards don't agree on their hash function (which routes keys to them) and layout
+	bool openExisting(const std::vector<std::string>& filenames);
+	bool openSnapshot(const ShardedMultiMap& source, uint32_t generation); //each of source's shards as of generation (see DiskMultiMap)
+	void close();
+	bool isOpen() const { return !m_shards.empty(); }
+	void setVersions(PageVersions* versions); //adds every shard's file to versions, in shard order
+	bool setGeneration(uint32_t generation, bool write = true); //see DiskMultiMap
+	uint32_t generation() const; //the latest any shard has recorded
+	bool flush();
+
+	unsigned int shards() const { return (unsigned int)m_shards.size(); }
+	unsigned int shardOf(const std::string& key) const;
+	DiskMultiMap& shard(unsigned int i) { return *m_shards[i]; }
+	const DiskMultiMap& shard(unsigned int i) const { return *m_shards[i]; }
+
+	bool insert(const std::string& key, const std::string& value, const std::string& context) { return shard(shardOf(key)).insert(key, value, context); }
+	Iterator search(const std::string& key) { return shard(shardOf(key)).search(key); }
+	int erase(const std::string& key, const std::string& value, const std::string& context) { return shard(shardOf(key)).erase(key, value, context); }
+	Stats stats() const; //every shard's counters merged
+	HashFunction hashFunction() const { return m_hashFunction; }
+	DiskMultiMap::Layout layout() const { return m_shards.empty() ? DiskMultiMap::CHAINED : m_shards[0]->layout(); }
+
+private:
+	std::vector<std::unique_ptr<DiskMultiMap> > m_shards;
+	HashFunction m_hashFunction;
+	KeyHasher m_hasher;
+
+	ShardedMultiMap(const ShardedMultiMap&);
+	ShardedMultiMap& operator=(const ShardedMultiMap&);
+};
+
+#endif // SHARDEDMULTIMAP_H_
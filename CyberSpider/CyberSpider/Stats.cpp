@@ -0,0 +1,101 @@
+#include "Stats.h"
+#include <iostream>
+#include <cstring>
+
+void Histogram::clear() {
+	memset(buckets, 0, sizeof(buckets));
+	count = sum = max = 0;
+}
+void Histogram::merge(const Histogram& other) {
+	for (int i = 0; i < NUM_BUCKETS; i++) buckets[i] += other.buckets[i];
+	count += other.count; sum += other.sum;
+	if (other.max > max) max = other.max;
+}
+void Histogram::print(std::ostream& out, const char* name) const {
+	out << "  " << name << ": count " << count;
+	if (count == 0) {
+		out << std::endl;
+		return;
+	}
+	out << ", mean " << (double)sum / count << ", max " << max << std::endl << "   ";
+	//only print the buckets that were hit, as [low, high): count
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		if (buckets[i] == 0) continue;
+		uint64_t low = (i == 0) ? 0 : (uint64_t(1) << (i - 1));
+		uint64_t high = uint64_t(1) << i;
+		out << " [" << low << "," << high << "):" << buckets[i];
+	}
+	out << std::endl;
+}
+
+void IoStats::merge(const IoStats& other) {
+	reads += other.reads; writes += other.writes; seeks += other.seeks;
+	bytesRead += other.bytesRead; bytesWritten += other.bytesWritten;
+}
+
+void Stats::clear() {
+	io.clear();
+	inserts = searches = erases = 0;
+	searchChain.clear(); insertChain.clear(); insertValueList.clear();
+	vctReused = vctAppended = ktReused = ktAppended = 0;
+	vctFreed = ktFreed = 0;
+	reuseDeferred = 0;
+	listsPacked = blocksAppended = blocksReused = blocksFreed = 0;
+	pagesRead = fingerprintCollisions = overflowPages = overflowFreed = 0;
+	batches = 0;
+	batchInFlight.clear();
+	flushes = compactions = runsProbed = blocksRead = 0;
+	crawls = knownGoodSkipped = 0;
+	crawlSearchNs.clear(); crawlExpandNs.clear(); crawlOutputNs.clear(); crawlArenaBytes.clear();
+}
+
+void Stats::merge(const Stats& other) {
+	io.merge(other.io);
+	inserts += other.inserts; searches += other.searches; erases += other.erases;
+	searchChain.merge(other.searchChain); insertChain.merge(other.insertChain); insertValueList.merge(other.insertValueList);
+	vctReused += other.vctReused; vctAppended += other.vctAppended; ktReused += other.ktReused; ktAppended += other.ktAppended;
+	vctFreed += other.vctFreed; ktFreed += other.ktFreed;
+	reuseDeferred += other.reuseDeferred;
+	listsPacked += other.listsPacked; blocksAppended += other.blocksAppended; blocksReused += other.blocksReused; blocksFreed += other.blocksFreed;
+	pagesRead += other.pagesRead; fingerprintCollisions += other.fingerprintCollisions; overflowPages += other.overflowPages; overflowFreed += other.overflowFreed;
+	batches += other.batches;
+	batchInFlight.merge(other.batchInFlight);
+	flushes += other.flushes; compactions += other.compactions; runsProbed += other.runsProbed; blocksRead += other.blocksRead;
+	crawls += other.crawls;
+	knownGoodSkipped += other.knownGoodSkipped;
+	crawlSearchNs.merge(other.crawlSearchNs); crawlExpandNs.merge(other.crawlExpandNs); crawlOutputNs.merge(other.crawlOutputNs); crawlArenaBytes.merge(other.crawlArenaBytes);
+}
+
+void Stats::print(std::ostream& out) const {
+#ifdef CYBERSPIDER_NO_STATS
+	out << "stats: compiled out (CYBERSPIDER_NO_STATS)" << std::endl;
+#else
+	out << "io: " << io.reads << " reads (" << io.bytesRead << " bytes), " << io.writes << " writes (" << io.bytesWritten
+		<< " bytes), " << io.seeks << " seeks" << std::endl;
+	out << "operations: " << inserts << " inserts, " << searches << " searches, " << erases << " erases" << std::endl;
+	searchChain.print(out, "search key chain length");
+	insertChain.print(out, "insert key chain length");
+	insertValueList.print(out, "insert value list length");
+	out << "  ValueContextTuples: " << vctReused << " reused, " << vctAppended << " appended, " << vctFreed << " freed" << std::endl;
+	out << "  KeyTuples: " << ktReused << " reused, " << ktAppended << " appended, " << ktFreed << " freed" << std::endl;
+	if (reuseDeferred)
+		out << "  free-list reuse deferred for snapshots: " << reuseDeferred << std::endl;
+	if (listsPacked || blocksAppended)
+		out << "  value blocks: " << listsPacked << " lists packed, " << blocksAppended << " appended, " << blocksReused << " reused, " << blocksFreed << " freed" << std::endl;
+	if (pagesRead || overflowPages)
+		out << "  bucket pages: " << pagesRead << " read, " << fingerprintCollisions << " fingerprint collisions, " << overflowPages << " overflow pages added, " << overflowFreed << " freed" << std::endl;
+	if (batches) {
+		out << "  batched searches: " << batches << " batches" << std::endl;
+		batchInFlight.print(out, "reads in flight");
+	}
+	if (flushes || compactions || runsProbed)
+		out << "lsm: " << flushes << " flushes, " << compactions << " compactions, " << runsProbed << " runs probed, " << blocksRead << " blocks read" << std::endl;
+	out << "crawl: " << crawls << " crawls";
+	if (knownGoodSkipped) out << ", " << knownGoodSkipped << " known-good entities not searched";
+	out << std::endl;
+	crawlSearchNs.print(out, "search phase (ns)");
+	crawlExpandNs.print(out, "expand phase (ns)");
+	crawlOutputNs.print(out, "output phase (ns)");
+	crawlArenaBytes.print(out, "arena bytes");
+#endif
+}
@@ -0,0 +1,78 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+
+//hot-path counters for DiskMultiMap, LSMMultiMap and IntelWeb
+//each map owns its Stats and is only used from one thread at a time, so counters are plain integers with no atomics or locking
+//define CYBERSPIDER_NO_STATS to compile all counting out (stats() then returns zeros)
+
+#ifdef CYBERSPIDER_NO_STATS
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_RECORD(histogram, v) ((void)0)
+#define STATS_NOW() uint64_t(0)
+#else
+#define STATS_ADD(counter, n) ((counter) += (n))
+#define STATS_RECORD(histogram, v) ((histogram).add(v))
+#define STATS_NOW() uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count())
+#endif
+
+//power-of-two histogram: bucket i counts values in [2^(i-1), 2^i), bucket 0 counts zeros
+struct Histogram {
+	static const int NUM_BUCKETS = 40;
+	Histogram() { clear(); }
+	void clear();
+	void add(uint64_t v) {
+		int b = 0;
+		while (v >> b && b < NUM_BUCKETS - 1) b++;
+		buckets[b]++; count++; sum += v;
+		if (v > max) max = v;
+	}
+	void merge(const Histogram& other);
+	void print(std::ostream& out, const char* name) const;
+
+	uint64_t buckets[NUM_BUCKETS];
+	uint64_t count, sum, max;
+};
+
+struct IoStats {
+	IoStats() { clear(); }
+	void clear() { reads = writes = seeks = bytesRead = bytesWritten = 0; }
+	void merge(const IoStats& other);
+	uint64_t reads, writes, seeks, bytesRead, bytesWritten;
+};
+
+struct Stats {
+	Stats() { clear(); }
+	void clear();
+	void merge(const Stats& other);
+	void print(std::ostream& out) const;
+
+	IoStats io;
+	uint64_t inserts, searches, erases;
+	Histogram searchChain; //KeyTuples read per search
+	Histogram insertChain; //KeyTuples read per insert
+	Histogram insertValueList; //ValueContextTuples walked per insert to reach the end of the key's list
+	uint64_t vctReused, vctAppended, ktReused, ktAppended; //free-list reuse vs growing the file
+	uint64_t vctFreed, ktFreed;
+	uint64_t reuseDeferred; //allocations that grew the file because the free list's head was still in a pinned snapshot
+	uint64_t listsPacked, blocksAppended, blocksReused, blocksFreed; //value lists moved into ValueBlocks, and blocks allocated and freed
+	uint64_t pagesRead, fingerprintCollisions, overflowPages, overflowFreed; //PAGED layout: bucket pages read, fingerprint matches with a different key, pages added and freed
+	uint64_t batches; //DiskMultiMap::searchBatch calls (each of their keys also counts as a search)
+	Histogram batchInFlight; //reads in flight each time searchBatch waited for one
+
+	//LSMMultiMap
+	uint64_t flushes, compactions, runsProbed, blocksRead;
+
+	//IntelWeb::crawl phases, in nanoseconds per crawl
+	uint64_t crawls;
+	uint64_t knownGoodSkipped; //entities a PrevalenceReport already showed to be popular, so crawl didn't search them
+	Histogram crawlSearchNs; //searching and iterating the maps
+	Histogram crawlExpandNs; //updating state, the queue and the interaction set
+	Histogram crawlOutputNs; //sorting and copying out the results
+	Histogram crawlArenaBytes; //memory the crawl's Arena handed out for its state
+};
+
+#endif // STATS_H_
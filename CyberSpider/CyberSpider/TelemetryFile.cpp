@@ -0,0 +1,300 @@
+#include "TelemetryFile.h"
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const size_t CONVERT_CHUNK_BYTES = 1 << 20;
+
+bool TelemetryFile::isBinary(const std::string& filename) {
+	std::ifstream inf(filename, std::ios::binary);
+	uint32_t magic = 0;
+	return inf.read(reinterpret_cast<char*>(&magic), sizeof(magic)) && magic == MAGIC;
+}
+
+bool TelemetryFile::convert(const std::string& textFile, const std::string& binaryFile, uint64_t& badLines) {
+	badLines = 0;
+	std::ifstream inf(textFile, std::ios::binary);
+	if (!inf) return false;
+	Writer writer;
+	if (!writer.createNew(binaryFile)) return false;
+	//read big chunks and hand over the whole lines in each; the line the chunk cut off is moved to the front for the next read
+	std::vector<char> buffer(CONVERT_CHUNK_BYTES);
+	size_t kept = 0;
+	for (;;) {
+		inf.read(buffer.data() + kept, buffer.size() - kept);
+		size_t length = kept + (size_t)inf.gcount();
+		if (length == kept) break;
+		size_t end = length;
+		while (end > 0 && buffer[end - 1] != '\n') end--;
+		if (end == 0) { //no newline yet: a line longer than the buffer, or the last line
+			if (length == buffer.size()) buffer.resize(buffer.size() * 2);
+			kept = length;
+			continue;
+		}
+		if (!writer.appendText(buffer.data(), end, badLines)) return false;
+		memmove(buffer.data(), buffer.data() + end, length - end);
+		kept = length - end;
+	}
+	if (kept > 0 && !writer.appendText(buffer.data(), kept, badLines)) return false;
+	return writer.close();
+}
+
+TelemetryFile::Writer::Writer() {
+	m_ok = false;
+	m_blocks = 0;
+	m_events = 0;
+	m_blockBytes = sizeof(BlockHeader);
+}
+TelemetryFile::Writer::~Writer() {
+	if (m_file.is_open()) close();
+}
+
+bool TelemetryFile::Writer::createNew(const std::string& filename) {
+	if (m_file.is_open()) close();
+	m_file.open(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+	m_blocks = 0;
+	m_events = 0;
+	m_blockBytes = sizeof(BlockHeader);
+	for (int c = 0; c < COLUMNS; c++) {
+		m_ids[c].clear();
+		m_names[c].clear();
+		m_columns[c].clear();
+	}
+	//the header is rewritten by close with the real counts; until then the file is too long for them, so Reader rejects it
+	FileHeader header = { MAGIC, VERSION, BLOCK_BYTES, 0, 0 };
+	m_ok = m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)).good();
+	return m_ok;
+}
+
+bool TelemetryFile::Writer::append(const char* context, size_t contextLength, const char* initiator, size_t initiatorLength, const char* target, size_t targetLength) {
+	const char* names[COLUMNS] = { context, initiator, target };
+	size_t lengths[COLUMNS] = { contextLength, initiatorLength, targetLength };
+	if (!m_ok) return false;
+	for (int c = 0; c < COLUMNS; c++)
+		if (lengths[c] == 0 || lengths[c] > MAX_NAME_BYTES) return false;
+
+	//the event's ids, or -1 for names new to this block, and how many bytes it adds to the block
+	int ids[COLUMNS];
+	size_t added = COLUMNS * sizeof(uint16_t);
+	for (int c = 0; c < COLUMNS; c++) {
+		m_key.assign(names[c], lengths[c]);
+		std::unordered_map<std::string, uint16_t>::const_iterator it = m_ids[c].find(m_key);
+		ids[c] = (it == m_ids[c].end()) ? -1 : it->second;
+		if (ids[c] == -1) added += sizeof(uint16_t) + lengths[c];
+	}
+	if (m_blockBytes + added > BLOCK_BYTES) {
+		//a full block: the event starts the next one, where all its names are new
+		if (!writeBlock()) return false;
+		added = COLUMNS * sizeof(uint16_t);
+		for (int c = 0; c < COLUMNS; c++) {
+			ids[c] = -1;
+			added += sizeof(uint16_t) + lengths[c];
+		}
+	}
+	for (int c = 0; c < COLUMNS; c++) {
+		if (ids[c] == -1) {
+			ids[c] = (int)m_ids[c].size();
+			m_key.assign(names[c], lengths[c]);
+			m_ids[c].insert(std::make_pair(m_key, (uint16_t)ids[c]));
+			uint16_t length = (uint16_t)lengths[c];
+			m_names[c].append(reinterpret_cast<const char*>(&length), sizeof(length));
+			m_names[c].append(names[c], lengths[c]);
+		}
+		m_columns[c].push_back((uint16_t)ids[c]);
+	}
+	m_blockBytes += added;
+	m_events++;
+	return true;
+}
+
+bool TelemetryFile::Writer::appendText(const char* text, size_t length, uint64_t& badLines) {
+	const char* p = text;
+	const char* end = text + length;
+	while (p < end) {
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+		if (lineEnd == nullptr) lineEnd = end;
+		//the same names istream >> would pick out; anything after the third is ignored, as ingest does
+		const char* names[COLUMNS];
+		size_t lengths[COLUMNS];
+		int found = 0;
+		while (found < COLUMNS) {
+			while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) p++;
+			if (p == lineEnd) break;
+			names[found] = p;
+			while (p < lineEnd && !(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) p++;
+			lengths[found] = p - names[found];
+			found++;
+		}
+		if (found < COLUMNS || lengths[0] > MAX_NAME_BYTES || lengths[1] > MAX_NAME_BYTES || lengths[2] > MAX_NAME_BYTES)
+			badLines++;
+		else if (!append(names[CONTEXT], lengths[CONTEXT], names[INITIATOR], lengths[INITIATOR], names[TARGET], lengths[TARGET]))
+			return false;
+		p = lineEnd + 1;
+	}
+	return true;
+}
+
+bool TelemetryFile::Writer::writeBlock() {
+	uint32_t events = (uint32_t)m_columns[CONTEXT].size();
+	if (!m_ok || events == 0) return m_ok;
+	//header, id columns and dictionaries, zero padded to BLOCK_BYTES
+	m_block.assign(BLOCK_BYTES, 0);
+	BlockHeader header;
+	header.events = events;
+	for (int c = 0; c < COLUMNS; c++) header.names[c] = (uint32_t)m_ids[c].size();
+	header.bytes = (uint32_t)m_blockBytes;
+	header.reserved = 0;
+	char* p = m_block.data();
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
+	for (int c = 0; c < COLUMNS; c++) {
+		memcpy(p, m_columns[c].data(), events * sizeof(uint16_t));
+		p += events * sizeof(uint16_t);
+	}
+	for (int c = 0; c < COLUMNS; c++) {
+		memcpy(p, m_names[c].data(), m_names[c].size());
+		p += m_names[c].size();
+	}
+	m_ok = m_file.write(m_block.data(), m_block.size()).good();
+	m_blocks++;
+	m_blockBytes = sizeof(BlockHeader);
+	for (int c = 0; c < COLUMNS; c++) {
+		m_ids[c].clear();
+		m_names[c].clear();
+		m_columns[c].clear();
+	}
+	return m_ok;
+}
+
+bool TelemetryFile::Writer::close() {
+	if (!m_file.is_open()) return false;
+	bool ok = writeBlock();
+	if (ok) {
+		FileHeader header = { MAGIC, VERSION, BLOCK_BYTES, m_blocks, m_events };
+		m_file.seekp(0);
+		ok = m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)).good();
+	}
+	m_file.close();
+	m_ok = false;
+	return ok && !m_file.fail();
+}
+
+TelemetryFile::Reader::Reader() {
+	m_data = nullptr;
+	m_length = 0;
+	m_blockBytes = m_blocks = 0;
+	m_events = 0;
+#ifdef _WIN32
+	m_handle = m_mapping = nullptr;
+#endif
+}
+TelemetryFile::Reader::~Reader() {
+	close();
+}
+
+bool TelemetryFile::Reader::open(const std::string& filename) {
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	m_handle = file;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG)sizeof(FileHeader)) {
+		close();
+		return false;
+	}
+	m_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL) {
+		close();
+		return false;
+	}
+	m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr) {
+		close();
+		return false;
+	}
+	m_length = (size_t)size.QuadPart;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FileHeader)) {
+		::close(fd);
+		return false;
+	}
+	void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps the file open
+	if (data == MAP_FAILED) return false;
+#if defined(MADV_SEQUENTIAL)
+	madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL); //ingest reads it front to back once, so read ahead and drop pages behind
+#endif
+	m_data = static_cast<const char*>(data);
+	m_length = (size_t)st.st_size;
+#endif
+	FileHeader header;
+	memcpy(&header, m_data, sizeof(header));
+	//a block must keep its id columns 2-byte aligned, and a file whose writer didn't finish has more bytes than its header counts
+	if (header.magic != MAGIC || header.version != VERSION || header.blockBytes < sizeof(BlockHeader) || header.blockBytes % 8 != 0 ||
+		m_length != sizeof(FileHeader) + (uint64_t)header.blocks * header.blockBytes) {
+		close();
+		return false;
+	}
+	m_blockBytes = header.blockBytes;
+	m_blocks = header.blocks;
+	m_events = header.events;
+	return true;
+}
+
+void TelemetryFile::Reader::close() {
+#ifdef _WIN32
+	if (m_data != nullptr) UnmapViewOfFile(m_data);
+	if (m_mapping != nullptr) CloseHandle(m_mapping);
+	if (m_handle != nullptr) CloseHandle(m_handle);
+	m_handle = m_mapping = nullptr;
+#else
+	if (m_data != nullptr) munmap(const_cast<char*>(m_data), m_length);
+#endif
+	m_data = nullptr;
+	m_length = 0;
+	m_blockBytes = m_blocks = 0;
+	m_events = 0;
+}
+
+bool TelemetryFile::Reader::readBlock(uint32_t block, Block& result) const {
+	result.events = 0;
+	if (block >= m_blocks) return false;
+	const char* start = m_data + sizeof(FileHeader) + (size_t)block * m_blockBytes;
+	BlockHeader header;
+	memcpy(&header, start, sizeof(header));
+	size_t columnBytes = (size_t)header.events * sizeof(uint16_t);
+	if (header.bytes > m_blockBytes || header.bytes < sizeof(header) + COLUMNS * columnBytes) return false;
+	const char* names = start + sizeof(header) + COLUMNS * columnBytes;
+	const char* end = start + header.bytes;
+	for (int c = 0; c < COLUMNS; c++) {
+		//ids are 16-bit and every name costs at least its length prefix, so a larger count is corruption
+		if (header.names[c] > 65536 || (uint64_t)header.names[c] * sizeof(uint16_t) > (uint64_t)(end - names)) return false;
+		result.names[c].resize(header.names[c]);
+		for (uint32_t i = 0; i < header.names[c]; i++) {
+			uint16_t length;
+			if (end - names < (ptrdiff_t)sizeof(length)) return false;
+			memcpy(&length, names, sizeof(length));
+			names += sizeof(length);
+			if (end - names < (ptrdiff_t)length) return false;
+			result.names[c][i].assign(names, length);
+			names += length;
+		}
+		result.ids[c] = reinterpret_cast<const uint16_t*>(start + sizeof(header) + c * columnBytes);
+		for (uint32_t i = 0; i < header.events; i++)
+			if (result.ids[c][i] >= header.names[c]) return false;
+	}
+	result.events = header.events;
+	return true;
+}
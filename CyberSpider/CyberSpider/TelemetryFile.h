@@ -0,0 +1,103 @@
+#ifndef TELEMETRYFILE_H_
+#define TELEMETRYFILE_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <cstddef>
+#include <cstdint>
+
+//binary telemetry: the same (context, initiator, target) events as a text log, so ingest can skip tokenizing
+//the file is a header and then fixed-size blocks; each block holds its events as three columns of 16-bit ids (all the contexts,
+//then all the initiators, then all the targets) followed by a dictionary per column of the names those ids stand for
+//every block starts over with empty dictionaries, so a block is decoded on its own and a writer only keeps one block in memory
+class TelemetryFile {
+public:
+	static const uint32_t MAGIC = 0xC57E1E01; //not printable, so a text log never starts with it
+	static const uint32_t VERSION = 1;
+	static const uint32_t BLOCK_BYTES = 65536;
+	static const size_t MAX_NAME_BYTES = 4096;
+	enum Column { CONTEXT, INITIATOR, TARGET, COLUMNS };
+
+	static bool isBinary(const std::string& filename); //whether the file starts with MAGIC
+	//a text log to the binary format; lines without three names are skipped (as ingest does) and counted in badLines
+	static bool convert(const std::string& textFile, const std::string& binaryFile, uint64_t& badLines);
+
+	class Writer {
+	public:
+		Writer();
+		~Writer();
+		bool createNew(const std::string& filename);
+		//false if a name is empty or longer than MAX_NAME_BYTES, or the file can't be written
+		bool append(const char* context, size_t contextLength, const char* initiator, size_t initiatorLength, const char* target, size_t targetLength);
+		//text log lines: the first three whitespace-separated names of each line are appended, and lines with fewer are counted in badLines
+		//the last line needn't end in a newline, so text must not stop partway through a line
+		bool appendText(const char* text, size_t length, uint64_t& badLines);
+		bool close(); //writes the last block and the header; false if anything couldn't be written
+		uint64_t events() const { return m_events; }
+	private:
+		bool writeBlock();
+
+		std::ofstream m_file;
+		bool m_ok;
+		uint32_t m_blocks;
+		uint64_t m_events;
+		//the block being built
+		size_t m_blockBytes; //once encoded
+		std::unordered_map<std::string, uint16_t> m_ids[COLUMNS];
+		std::string m_names[COLUMNS]; //each dictionary encoded, in id order
+		std::vector<uint16_t> m_columns[COLUMNS];
+		std::string m_key; //reused for dictionary lookups
+		std::vector<char> m_block;
+
+		Writer(const Writer&);
+		Writer& operator=(const Writer&);
+	};
+
+	//one block decoded: the names are copied out once per block, and events refer to them by id
+	struct Block {
+		unsigned int events;
+		std::vector<std::string> names[COLUMNS]; //reused from block to block, so their buffers are too
+		const uint16_t* ids[COLUMNS]; //into the mapped file
+		const std::string& name(Column column, unsigned int event) const { return names[column][ids[column][event]]; }
+	};
+
+	//maps the whole file read-only, so reading a block is decoding its dictionaries in place
+	class Reader {
+	public:
+		Reader();
+		~Reader();
+		bool open(const std::string& filename); //false if the file can't be mapped or isn't a complete binary telemetry file
+		void close();
+		uint32_t blocks() const { return m_blocks; }
+		uint64_t events() const { return m_events; }
+		bool readBlock(uint32_t block, Block& result) const; //false if the block is corrupt (an id or name runs past its dictionary or the block)
+	private:
+		const char* m_data;
+		size_t m_length;
+		uint32_t m_blockBytes, m_blocks;
+		uint64_t m_events;
+#ifdef _WIN32
+		void* m_handle; //HANDLEs of the file and its mapping
+		void* m_mapping;
+#endif
+
+		Reader(const Reader&);
+		Reader& operator=(const Reader&);
+	};
+
+private:
+	struct FileHeader {
+		uint32_t magic, version, blockBytes, blocks;
+		uint64_t events;
+	};
+	struct BlockHeader {
+		uint32_t events;
+		uint32_t names[COLUMNS]; //entries in each dictionary
+		uint32_t bytes; //used, out of BLOCK_BYTES
+		uint32_t reserved;
+	};
+};
+
+#endif // TELEMETRYFILE_H_
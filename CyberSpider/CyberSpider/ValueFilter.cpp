@@ -0,0 +1,37 @@
+#include "ValueFilter.h"
+#include <fstream>
+#include <sstream>
+
+ValueFilter::ValueFilter() : m_arena(4096) {
+}
+
+void ValueFilter::allowContext(const std::string& context) {
+	m_allowed.insert(keep(context));
+}
+void ValueFilter::denyContext(const std::string& context) {
+	m_denied.insert(keep(context));
+}
+void ValueFilter::excludeValue(const std::string& value) {
+	m_excluded.insert(keep(value));
+}
+void ValueFilter::excludeValuePrefix(const std::string& prefix) {
+	m_prefixes.push_back(keep(prefix));
+}
+
+bool ValueFilter::load(const std::string& filename) {
+	std::ifstream inf(filename);
+	if (!inf) return false;
+	std::string line;
+	while (getline(inf, line)) {
+		std::istringstream iss(line);
+		std::string rule, name;
+		if (!(iss >> rule)) continue; //blank line
+		if (!(iss >> name)) return false;
+		if (rule == "allow") allowContext(name);
+		else if (rule == "deny") denyContext(name);
+		else if (rule == "exclude") excludeValue(name);
+		else if (rule == "exclude-prefix") excludeValuePrefix(name);
+		else return false;
+	}
+	return true;
+}
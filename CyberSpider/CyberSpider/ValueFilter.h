@@ -0,0 +1,46 @@
+#ifndef VALUEFILTER_H_
+#define VALUEFILTER_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include "Arena.h"
+
+//which (value, context) pairs of a key's list to keep: contexts (machines) to allow or deny, and values (entities) to leave out by name or prefix
+//the maps check it against the raw bytes while they iterate, so a pair that's filtered out is never built into a MultiMapTuple
+class ValueFilter {
+public:
+	ValueFilter();
+	void allowContext(const std::string& context); //once any context is allowed, all others are left out
+	void denyContext(const std::string& context);
+	void excludeValue(const std::string& value);
+	void excludeValuePrefix(const std::string& prefix); //eg. a URL prefix
+	//one rule per line: "allow context", "deny context", "exclude value" or "exclude-prefix prefix"; false if the file can't be read or a line isn't a rule
+	bool load(const std::string& filename);
+	bool empty() const { return m_allowed.empty() && m_denied.empty() && m_excluded.empty() && m_prefixes.empty(); }
+
+	bool accepts(const char* value, size_t valueLength, const char* context, size_t contextLength) const {
+		if (!m_allowed.empty() && !m_allowed.count(ArenaString(context, contextLength))) return false;
+		if (!m_denied.empty() && m_denied.count(ArenaString(context, contextLength))) return false;
+		if (!m_excluded.empty() && m_excluded.count(ArenaString(value, valueLength))) return false;
+		for (size_t i = 0; i < m_prefixes.size(); i++)
+			if (m_prefixes[i].length <= valueLength && !memcmp(m_prefixes[i].data, value, m_prefixes[i].length)) return false;
+		return true;
+	}
+	bool accepts(const std::string& value, const std::string& context) const {
+		return accepts(value.data(), value.size(), context.data(), context.size());
+	}
+
+private:
+	ArenaString keep(const std::string& s) { return ArenaString(m_arena.copy(s.data(), s.size()), s.size()); }
+
+	Arena m_arena; //the names the sets point at
+	std::unordered_set<ArenaString, ArenaStringHash> m_allowed, m_denied, m_excluded;
+	std::vector<ArenaString> m_prefixes;
+
+	ValueFilter(const ValueFilter&);
+	ValueFilter& operator=(const ValueFilter&);
+};
+
+#endif // VALUEFILTER_H_
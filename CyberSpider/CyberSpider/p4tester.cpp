@@ -1,15 +1,17 @@
 #include "IntelWeb.h"
 #include "InteractionTuple.h"
+#include "ResultGraph.h"
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <vector>
-#include <map>
-#include <set>
 #include <string>
+#include <algorithm>
 #include <cstdlib>
 using namespace std;
 
+bool printStats = false;	// set by -t
+const size_t DEFAULT_HUBS = 1000;	// -r reports this many hubs unless told otherwise
+
 bool getLinesFromFile(string filename, vector<string>& data)
 {
 	ifstream inf(filename);
@@ -21,10 +23,11 @@ bool getLinesFromFile(string filename, vector<string>& data)
 	return true;
 }
 
-bool createDB(string databasePrefix, unsigned int expectedMaxNumberOfItems)
+bool createDB(string databasePrefix, unsigned int expectedMaxNumberOfItems, IntelWeb::Engine engine, HashFunction hashFunction,
+	const vector<string>& shardPrefixes)
 {
 	IntelWeb iw;
-	if (!iw.createNew(databasePrefix, expectedMaxNumberOfItems))
+	if (!iw.createNew(databasePrefix, expectedMaxNumberOfItems, engine, hashFunction, shardPrefixes))
 	{
 		cout << "Error: Cannot create database with prefix " << databasePrefix
 			<< " with " << expectedMaxNumberOfItems << " items expected." << endl;
@@ -45,10 +48,26 @@ bool ingest(string databasePrefix, string telemetryLogFile)
 		cout << "Error: Ingesting telemetry data from " << telemetryLogFile << " failed." << endl;
 		return false;
 	}
+	if (printStats)
+		iw.stats().print(cout);
 	return true;
 }
 
-bool crawl(string databasePrefix, string indicatorFile, unsigned int minGoodPrevalence, string resultsFile)
+bool convert(string telemetryLogFile, string binaryLogFile)
+{
+	uint64_t badLines;
+	if (!TelemetryFile::convert(telemetryLogFile, binaryLogFile, badLines))
+	{
+		cout << "Error: Converting " << telemetryLogFile << " to " << binaryLogFile << " failed." << endl;
+		return false;
+	}
+	if (badLines > 0)
+		cout << "Skipped " << badLines << " badly-formatted lines" << endl;
+	return true;
+}
+
+bool crawl(string databasePrefix, string indicatorFile, unsigned int minGoodPrevalence, string resultsFile, unsigned int concurrency, string filterFile,
+	string knownGoodFile)
 {
 	if (minGoodPrevalence <= 1)
 	{
@@ -75,10 +94,25 @@ bool crawl(string databasePrefix, string indicatorFile, unsigned int minGoodPrev
 		return false;
 	}
 
+	ValueFilter filter;
+	if (!filterFile.empty() && filterFile != "-" && !filter.load(filterFile))
+	{
+		cout << "Error: Cannot read filter file " << filterFile << endl;
+		return false;
+	}
+	PrevalenceReport knownGood;	// hubs written by -r, which crawl needn't search
+	if (!knownGoodFile.empty() && !knownGood.load(knownGoodFile))
+	{
+		cout << "Error: Cannot read known-good file " << knownGoodFile << endl;
+		return false;
+	}
+
 	vector<string> badEntitiesFound;
 	vector<InteractionTuple> badInteractions;
 
-	iw.crawl(indicators, minGoodPrevalence, badEntitiesFound, badInteractions);
+	iw.crawl(indicators, minGoodPrevalence, badEntitiesFound, badInteractions, concurrency, &filter, &knownGood);
+	if (printStats)
+		iw.stats().print(cout);
 
 	ofstream resultf(resultsFile);
 	if (!resultf)
@@ -98,6 +132,29 @@ bool crawl(string databasePrefix, string indicatorFile, unsigned int minGoodPrev
 	return true;
 }
 
+bool reportPrevalence(string databasePrefix, string hubsFile, size_t topK)
+{
+	IntelWeb iw;
+	if (!iw.openExisting(databasePrefix))
+	{
+		cout << "Error: Cannot open existing database with prefix " << databasePrefix << endl;
+		return false;
+	}
+	PrevalenceReport report;
+	if (!iw.reportPrevalence(report, topK))
+	{
+		cout << "Error: Cannot scan " << databasePrefix << " (-r needs a hash or paged database)" << endl;
+		return false;
+	}
+	report.print(cout);
+	if (!report.write(hubsFile))
+	{
+		cout << "Error: Cannot write hubs file " << hubsFile << endl;
+		return false;
+	}
+	return true;
+}
+
 bool purge(string databasePrefix, string purgeFile)
 {
 	IntelWeb iw;
@@ -117,104 +174,110 @@ bool purge(string databasePrefix, string purgeFile)
 
 	for (auto itemToPurge : purgeList)
 		iw.purge(itemToPurge);
+	if (printStats)
+		iw.stats().print(cout);
 	return true;
 }
 
-string generateCode(string machine, string& entity, const set<string>& badEntities)
-{
-	const string HTTP_STRING = "http://";
-
-	bool isBad = (badEntities.find(entity) != badEntities.end());
-
-	string badColor;
-	if (entity.substr(0, HTTP_STRING.size()) == HTTP_STRING)
-		badColor = "orange";
-	else
-	{
-		entity = entity + " (" + machine + ")";
-		badColor = "red";
-	}
-	return "nodes[\"" + entity + "\"] = {name: \"" + entity + "\", color: \"" +
-		(isBad ? badColor : "green") + "\"};";
-}
-
-void writeGraph(ostream& htmlf, const vector<string>& results)
+bool analyze(string databasePrefix)
 {
-	set<string> badEntities;
-	set<string> nodes;
-	vector<string> edges;
-
-	for (auto resultLine : results)
+	// works on the .dmm files directly, so only the hash and paged engines can be analyzed; a sharded database's files are analyzed one by one
+	for (const string& prefix : IntelWeb::shardPrefixes(databasePrefix))
 	{
-		istringstream iss(resultLine);
-		vector<string> tokens;
-		string s;
-		while (iss >> s)
-			tokens.push_back(s);
-
-		if (tokens.size() == 1)  // first part of result file: bad entities
-			badEntities.insert(tokens[0]);
-		else if (tokens.size() == 3)  // second part:  bad interactions
+		for (auto suffix : { "-initiator.dmm", "-target.dmm" })
 		{
-			string machine = tokens[0];
-			string from = tokens[1];
-			string to = tokens[2];
-
-			// Generate JavaScript statement like
-			//   nodes["blah.exe"] = {name: "blah.exe (m1066)", color: "red"};
-			nodes.insert(generateCode(machine, from, badEntities));
-			nodes.insert(generateCode(machine, to, badEntities));
-
-			// Generate JavaScript expression like
-			//   {source: nodes["blah.exe"], target: nodes["www.a.com"], type: "defaultedge"},
-			string edge = "{source: nodes[\"" + from + "\"], target: nodes[\"" + to + "\"], type: \"defaultedge\"},";
-			edges.push_back(edge);
+			DiskMultiMap dmm;
+			if (!dmm.openExisting(prefix + suffix))
+			{
+				cout << "Error: Cannot open " << prefix + suffix << endl;
+				return false;
+			}
+			DiskMultiMap::Analysis analysis;
+			if (!dmm.analyze(analysis))
+			{
+				cout << "Error: Cannot read " << prefix + suffix << endl;
+				return false;
+			}
+			cout << prefix + suffix << ":" << endl;
+			analysis.print(cout);
+			cout << endl;
 		}
 	}
-
-	if (!edges.empty())
-		edges.back().pop_back(); // remove final comma from last string
-
-	htmlf << "var nodes = { };\n";
-	for (const auto& n : nodes)
-		htmlf << n << "\n";
-
-	htmlf << "\nvar links = [\n";
-	for (const auto& e : edges)
-		htmlf << e << "\n";
-	htmlf << "];\n";
+	return true;
 }
 
-bool convertToJavaScript(string resultsFile, string templateFile, string htmlFile)
+// reads the results into a ResultGraph and collapses it to maxNodes (0 for no limit)
+bool loadGraph(string resultsFile, size_t maxNodes, ResultGraph::Reduction reduction, ResultGraph& graph)
 {
-	vector<string> results;
-	if (!getLinesFromFile(resultsFile, results))
+	if (!graph.load(resultsFile))
 	{
 		cout << "Error: Cannot open results file " << resultsFile << endl;
 		return false;
 	}
+	size_t nodes = graph.nodes().size(), edges = graph.edges().size();
+	graph.reduce(maxNodes, reduction);
+	if (graph.nodes().size() != nodes)
+		cout << "Collapsed " << nodes << " nodes and " << edges << " edges to " << graph.nodes().size()
+			<< " nodes and " << graph.edges().size() << " edges" << endl;
+	return true;
+}
 
-	vector<string> templateLines;
-	if (!getLinesFromFile(templateFile, templateLines))
+bool convertToJavaScript(string resultsFile, string templateFile, string htmlFile, size_t maxNodes, ResultGraph::Reduction reduction)
+{
+	ResultGraph graph;
+	if (!loadGraph(resultsFile, maxNodes, reduction, graph))
+		return false;
+
+	ifstream templatef(templateFile);
+	if (!templatef)
 	{
 		cout << "Error: Cannot open graph template file " << templateFile << endl;
 		return false;
 	}
 
 	ofstream htmlf(htmlFile);
-	if (!htmlf)
+	if (!htmlf || !graph.writeHtml(templatef, htmlf))
 	{
 		cout << "Error: Cannot write result graph file " << htmlFile << endl;
 		return false;
 	}
+	return true;
+}
+
+bool exportGraph(string resultsFile, bool binary, string outputFile, size_t maxNodes, ResultGraph::Reduction reduction)
+{
+	ResultGraph graph;
+	if (!loadGraph(resultsFile, maxNodes, reduction, graph))
+		return false;
+
+	ofstream outf(outputFile, ios::binary);
+	if (!outf || !(binary ? graph.writeBinary(outf) : graph.writeJson(outf)))
+	{
+		cout << "Error: Cannot write graph file " << outputFile << endl;
+		return false;
+	}
+	return true;
+}
 
-	const string PLACEHOLDER_STRING = "<PLACEHOLDER/>";
-	for (auto line : templateLines)
+// the optional [maxNodes [degree|machine]] after -w and -e
+bool parseReduction(int argc, char *argv[], int first, size_t& maxNodes, ResultGraph::Reduction& reduction)
+{
+	maxNodes = 0;
+	reduction = ResultGraph::TOP_DEGREE;
+	if (argc > first + 2)
+		return false;
+	if (argc > first)
 	{
-		if (line.find(PLACEHOLDER_STRING) == string::npos)
-			htmlf << line << endl;
-		else
-			writeGraph(htmlf, results);
+		if (atoi(argv[first]) < 0)
+			return false;
+		maxNodes = atoi(argv[first]);
+	}
+	if (argc > first + 1)
+	{
+		if (string(argv[first + 1]) == "machine")
+			reduction = ResultGraph::BY_MACHINE;
+		else if (string(argv[first + 1]) != "degree")
+			return false;
 	}
 	return true;
 }
@@ -222,50 +285,119 @@ bool convertToJavaScript(string resultsFile, string templateFile, string htmlFil
 void printUsageAndExit()
 {
 	cout << "Usage:" << endl;
-	cout << "  p4tester -b databasePrefix expectedNumberOfItems" << endl;
+	cout << "  p4tester -b databasePrefix expectedNumberOfItems [hash|paged|lsm] [wyhash|xxh64|fnv1a|std [shardPrefix...]]" << endl;
 	cout << "  p4tester -i databasePrefix telemetryLogfile" << endl;
-	cout << "  p4tester -s databasePrefix indicators minGoodPrevalence results" << endl;
+	cout << "  p4tester -c telemetryLogfile binaryLogfile" << endl;
+	cout << "  p4tester -s databasePrefix indicators minGoodPrevalence results [concurrency [filterFile|- [knownGoodFile]]]" << endl;
 	cout << "  p4tester -p databasePrefix purgeFile" << endl;
-	cout << "  p4tester -w results graphtemplate.html resultgraph.html" << endl;
+	cout << "  p4tester -w results graphtemplate.html resultgraph.html [maxNodes [degree|machine]]" << endl;
+	cout << "  p4tester -e results json|binary graphFile [maxNodes [degree|machine]]" << endl;
+	cout << "  p4tester -a databasePrefix" << endl;
+	cout << "  p4tester -r databasePrefix hubsFile [topK]" << endl;
+	cout << "  p4tester -t <-i|-s|-p command>   (runs the command and prints I/O and timing stats)" << endl;
 	exit(1);
 }
 
 int main(int argc, char *argv[])
 {
+	if (argc >= 2 && string(argv[1]) == "-t")
+	{
+		printStats = true;
+		argc--;
+		argv++;
+	}
 	if (argc < 2 || argv[1][0] != '-')
 		printUsageAndExit();
 	switch (argv[1][1])
 	{
 	case 'b':
-		if (argc != 4)
+	{
+		if (argc < 4)
+			printUsageAndExit();
+		IntelWeb::Engine engine = IntelWeb::HASH;
+		HashFunction hashFunction = DEFAULT_HASH_FUNCTION;
+		if (argc >= 5)
+		{
+			if (string(argv[4]) == "lsm")
+				engine = IntelWeb::LSM;
+			else if (string(argv[4]) == "paged")
+				engine = IntelWeb::PAGED;
+			else if (string(argv[4]) != "hash")
+				printUsageAndExit();
+		}
+		if (argc >= 6 && (engine == IntelWeb::LSM || !parseHashName(argv[5], hashFunction)))
 			printUsageAndExit();
-		if (!createDB(argv[2], atoi(argv[3])))
+		vector<string> shardPrefixes(argv + min(argc, 6), argv + argc);	// each shard's .dmm files, eg. on a disk of its own
+		if (!createDB(argv[2], atoi(argv[3]), engine, hashFunction, shardPrefixes))
 			return 1;
 		break;
+	}
 	case 'i':
 		if (argc != 4)
 			printUsageAndExit();
 		if (!ingest(argv[2], argv[3]))
 			return 1;
 		break;
+	case 'c':
+		if (argc != 4)
+			printUsageAndExit();
+		if (!convert(argv[2], argv[3]))
+			return 1;
+		break;
 	case 's':
-		if (argc != 6)
+	{
+		if (argc < 6 || argc > 9)
 			printUsageAndExit();
-		if (!crawl(argv[2], argv[3], atoi(argv[4]), argv[5]))
+		int concurrency = argc >= 7 ? atoi(argv[6]) : 1;
+		if (concurrency <= 0)
+			printUsageAndExit();
+		if (!crawl(argv[2], argv[3], atoi(argv[4]), argv[5], concurrency, argc >= 8 ? argv[7] : "", argc == 9 ? argv[8] : ""))
 			return 1;
 		break;
+	}
 	case 'p':
 		if (argc != 4)
 			printUsageAndExit();
 		if (!purge(argv[2], argv[3]))
 			return 1;
 		break;
+	case 'a':
+		if (argc != 3)
+			printUsageAndExit();
+		if (!analyze(argv[2]))
+			return 1;
+		break;
+	case 'r':
+	{
+		if (argc != 4 && argc != 5)
+			printUsageAndExit();
+		int topK = argc == 5 ? atoi(argv[4]) : DEFAULT_HUBS;
+		if (topK <= 0)
+			printUsageAndExit();
+		if (!reportPrevalence(argv[2], argv[3], topK))
+			return 1;
+		break;
+	}
 	case 'w':
-		if (argc != 5)
+	{
+		size_t maxNodes;
+		ResultGraph::Reduction reduction;
+		if (argc < 5 || !parseReduction(argc, argv, 5, maxNodes, reduction))
 			printUsageAndExit();
-		if (!convertToJavaScript(argv[2], argv[3], argv[4]))
+		if (!convertToJavaScript(argv[2], argv[3], argv[4], maxNodes, reduction))
 			return 1;
 		break;
+	}
+	case 'e':
+	{
+		size_t maxNodes;
+		ResultGraph::Reduction reduction;
+		if (argc < 5 || (string(argv[3]) != "json" && string(argv[3]) != "binary") || !parseReduction(argc, argv, 5, maxNodes, reduction))
+			printUsageAndExit();
+		if (!exportGraph(argv[2], string(argv[3]) == "binary", argv[4], maxNodes, reduction))
+			return 1;
+		break;
+	}
 	default:
 		printUsageAndExit();
 	}
@@ -0,0 +1,1227 @@
+#include "../CyberSpider/IntelWeb.h"
+#include "../CyberSpider/InteractionTuple.h"
+#include "../CyberSpider/DiskMultiMap.h"
+#include "../CyberSpider/AsyncFile.h"
+#include "../CyberSpider/TelemetryFile.h"
+#include "../p4gen/LogGenerator.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+using namespace std;
+
+const unsigned int BENCH_SEED = 20160309;	// fixed so every run benchmarks the same datasets
+const int DEFAULT_SCALES[] = { 1000, 5000, 20000 };
+const unsigned int CRAWL_PREVALENCES[] = { 2, 10, 100 };
+const int DEFAULT_HASH_SCALE = 5000;
+const int HASH_ROUNDS = 50;	// passes over the keys when timing the raw hash
+const int DEFAULT_LAYOUT_KEYS = 20000;
+const double LAYOUT_LOAD_FACTORS[] = { 0.75, 2, 4, 8 };	// keys per key slot
+const unsigned int DEFAULT_QUEUE_DEPTHS[] = { 1, 2, 4, 8, 16, 32, 64 };
+const size_t MAX_QUEUE_LOOKUPS = 20000;	// entities expanded per queue-depth run
+const size_t STRESS_CHUNK_LINES = 256;	// lines per ingest call in the snapshot stress test
+const unsigned int DEFAULT_STRESS_READERS = 4;
+const unsigned int STRESS_CRAWL_CONCURRENCY = 8;	// used by every other reader, so Lookups read snapshots too
+const unsigned int STRESS_PIN_TIMEOUT_SECONDS = 10;	// how long a snapshot may take to open after a failed ingest
+const unsigned int DEFAULT_MAX_SHARDS = 4;	// -d measures 1, 2, 4... shards up to this
+const unsigned int SHARD_CRAWL_CONCURRENCY = 16;	// -d times the sequential crawl and this one
+
+volatile uint64_t hashSink;	// keeps the timed hash calls from being optimized away
+
+bool getLinesFromFile(string filename, vector<string>& data)
+{
+	ifstream inf(filename);
+	if (!inf)
+		return false;
+	string line;
+	while (getline(inf, line))
+		data.push_back(line);
+	return true;
+}
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+const char* engineName(IntelWeb::Engine engine)
+{
+	return engine == IntelWeb::LSM ? "lsm" : engine == IntelWeb::PAGED ? "paged" : "hash";
+}
+
+bool generateLog(const vector<string>& goodSources, const vector<string>& maliciousLogs, int scale, const string& logFile)
+{
+	GeneratorOptions options;
+	options.numEvents = scale;
+	options.numMachines = max(1, scale / 10);	// same machine-to-event ratio for every scale
+	options.seed = BENCH_SEED;
+	options.numThreads = max(1u, thread::hardware_concurrency());
+	LogGenerator generator(goodSources, maliciousLogs, options);
+	return generator.generateLogs(logFile);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// -c: compare both engines on an existing telemetry log
+//////////////////////////////////////////////////////////////////////////
+
+struct EngineResult
+{
+	double ingestSeconds;
+	double crawlSeconds;
+	vector<string> badEntities;
+	vector<InteractionTuple> interactions;
+};
+
+bool runEngine(IntelWeb::Engine engine, const string& prefix, const string& telemetryFile,
+	const vector<string>& indicators, unsigned int minGoodPrevalence, unsigned int numItems, EngineResult& result)
+{
+	IntelWeb iw;
+	if (!iw.createNew(prefix, numItems, engine))
+	{
+		cout << "Error: Cannot create database with prefix " << prefix << endl;
+		return false;
+	}
+
+	// ingest includes close() so the LSM engine's final memtable flush is counted
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (!iw.ingest(telemetryFile))
+	{
+		cout << "Error: Ingesting telemetry data from " << telemetryFile << " failed." << endl;
+		return false;
+	}
+	iw.close();
+	result.ingestSeconds = secondsSince(start);
+
+	if (!iw.openExisting(prefix))
+	{
+		cout << "Error: Cannot open existing database with prefix " << prefix << endl;
+		return false;
+	}
+	start = chrono::steady_clock::now();
+	iw.crawl(indicators, minGoodPrevalence, result.badEntities, result.interactions);
+	result.crawlSeconds = secondsSince(start);
+	return true;
+}
+
+bool compareEngines(string telemetryFile, string indicatorFile, unsigned int minGoodPrevalence, unsigned int numItems)
+{
+	vector<string> indicators;
+	if (!getLinesFromFile(indicatorFile, indicators) || indicators.empty())
+	{
+		cout << "Error: Cannot read indicators file " << indicatorFile << endl;
+		return false;
+	}
+
+	EngineResult hash, lsm;
+	if (!runEngine(IntelWeb::HASH, "p4bench-hash", telemetryFile, indicators, minGoodPrevalence, numItems, hash) ||
+		!runEngine(IntelWeb::LSM, "p4bench-lsm", telemetryFile, indicators, minGoodPrevalence, numItems, lsm))
+		return false;
+
+	cout << "engine\tingest(s)\tcrawl(s)\tbadEntities\tinteractions" << endl;
+	cout << "hash\t" << hash.ingestSeconds << "\t" << hash.crawlSeconds << "\t"
+		<< hash.badEntities.size() << "\t" << hash.interactions.size() << endl;
+	cout << "lsm\t" << lsm.ingestSeconds << "\t" << lsm.crawlSeconds << "\t"
+		<< lsm.badEntities.size() << "\t" << lsm.interactions.size() << endl;
+
+	bool same = hash.badEntities == lsm.badEntities && hash.interactions.size() == lsm.interactions.size();
+	for (size_t i = 0; same && i < hash.interactions.size(); i++)
+	{
+		const InteractionTuple& a = hash.interactions[i];
+		const InteractionTuple& b = lsm.interactions[i];
+		same = a.from == b.from && a.to == b.to && a.context == b.context;
+	}
+	if (!same)
+	{
+		cout << "Error: engines returned different crawl results" << endl;
+		return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// -s: benchmark suite over generated datasets
+//////////////////////////////////////////////////////////////////////////
+
+struct Measurement
+{
+	int scale;				// numEvents passed to generateLogs
+	string engine;
+	string operation;		// createNew, ingest, crawl or purge
+	unsigned int param;		// minPrevalenceToBeGood for crawl, 0 otherwise
+	size_t items;			// lines ingested, or entities found/purged
+	vector<double> samples;	// seconds per operation
+};
+
+double percentile(vector<double> samples, double p)
+{
+	if (samples.empty())
+		return 0;
+	sort(samples.begin(), samples.end());
+	size_t i = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+	return samples[i];
+}
+
+double total(const vector<double>& samples)
+{
+	double sum = 0;
+	for (double s : samples)
+		sum += s;
+	return sum;
+}
+
+// entities from the malicious log that aren't good sources or machine names
+vector<string> maliciousEntities(const vector<string>& maliciousLogs, const vector<string>& goodSources)
+{
+	set<string> good(goodSources.begin(), goodSources.end());
+	set<string> entities;
+	for (const auto& line : maliciousLogs)
+	{
+		istringstream iss(line);
+		string context, from, to;
+		if (!(iss >> context >> from >> to))
+			continue;
+		if (!good.count(from))
+			entities.insert(from);
+		if (!good.count(to))
+			entities.insert(to);
+	}
+	return vector<string>(entities.begin(), entities.end());
+}
+
+bool benchmarkDataset(int scale, IntelWeb::Engine engine, const string& logFile, size_t numLines,
+	const vector<string>& indicators, vector<Measurement>& results)
+{
+	string prefix = string("p4bench-") + engineName(engine) + "-" + to_string(scale);
+	Measurement m;
+	m.scale = scale;
+	m.engine = engineName(engine);
+	m.param = 0;
+
+	IntelWeb iw;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (!iw.createNew(prefix, static_cast<unsigned int>(numLines), engine))
+	{
+		cout << "Error: Cannot create database with prefix " << prefix << endl;
+		return false;
+	}
+	m.operation = "createNew";
+	m.items = numLines;
+	m.samples.assign(1, secondsSince(start));
+	results.push_back(m);
+
+	start = chrono::steady_clock::now();
+	if (!iw.ingest(logFile))
+	{
+		cout << "Error: Ingesting telemetry data from " << logFile << " failed." << endl;
+		return false;
+	}
+	iw.close();
+	m.operation = "ingest";
+	m.samples.assign(1, secondsSince(start));
+	results.push_back(m);
+
+	if (!iw.openExisting(prefix))
+	{
+		cout << "Error: Cannot open existing database with prefix " << prefix << endl;
+		return false;
+	}
+
+	// one crawl per indicator gives enough samples for p50/p99
+	for (unsigned int prevalence : CRAWL_PREVALENCES)
+	{
+		m.operation = "crawl";
+		m.param = prevalence;
+		m.items = 0;
+		m.samples.clear();
+		for (const auto& indicator : indicators)
+		{
+			vector<string> badEntities;
+			vector<InteractionTuple> interactions;
+			start = chrono::steady_clock::now();
+			iw.crawl(vector<string>(1, indicator), prevalence, badEntities, interactions);
+			m.samples.push_back(secondsSince(start));
+			m.items += badEntities.size();
+		}
+		results.push_back(m);
+	}
+
+	m.operation = "purge";
+	m.param = 0;
+	m.items = indicators.size();
+	m.samples.clear();
+	for (const auto& indicator : indicators)
+	{
+		start = chrono::steady_clock::now();
+		iw.purge(indicator);
+		m.samples.push_back(secondsSince(start));
+	}
+	results.push_back(m);
+	return true;
+}
+
+void writeResults(const string& resultsPrefix, const vector<Measurement>& results)
+{
+	ofstream json(resultsPrefix + ".json");
+	ofstream csv(resultsPrefix + ".csv");
+	json << "{\n  \"seed\": " << BENCH_SEED << ",\n  \"results\": [\n";
+	csv << "scale,engine,operation,param,items,samples,total_s,p50_ms,p99_ms" << endl;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Measurement& m = results[i];
+		double p50 = percentile(m.samples, 0.50) * 1000;
+		double p99 = percentile(m.samples, 0.99) * 1000;
+		json << "    {\"scale\": " << m.scale << ", \"engine\": \"" << m.engine
+			<< "\", \"operation\": \"" << m.operation << "\", \"param\": " << m.param
+			<< ", \"items\": " << m.items << ", \"samples\": " << m.samples.size()
+			<< ", \"total_s\": " << total(m.samples) << ", \"p50_ms\": " << p50
+			<< ", \"p99_ms\": " << p99 << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+		csv << m.scale << "," << m.engine << "," << m.operation << "," << m.param << ","
+			<< m.items << "," << m.samples.size() << "," << total(m.samples) << ","
+			<< p50 << "," << p99 << "\n";
+	}
+	json << "  ]\n}\n";
+}
+
+bool runSuite(string sourcesFile, string maliciousFile, string resultsPrefix, const vector<int>& scales)
+{
+	vector<string> goodSources, maliciousLogs;
+	if (!getLinesFromFile(sourcesFile, goodSources) || goodSources.empty())
+	{
+		cout << "Error: can't open source file: " << sourcesFile << endl;
+		return false;
+	}
+	if (!getLinesFromFile(maliciousFile, maliciousLogs) || maliciousLogs.empty())
+	{
+		cout << "Error: can't open source file: " << maliciousFile << endl;
+		return false;
+	}
+	vector<string> indicators = maliciousEntities(maliciousLogs, goodSources);
+
+	vector<Measurement> results;
+	for (int scale : scales)
+	{
+		string logFile = "p4bench-" + to_string(scale) + ".txt";
+		if (!generateLog(goodSources, maliciousLogs, scale, logFile))
+		{
+			cout << "Error: problem generating logs" << endl;
+			return false;
+		}
+		vector<string> lines;
+		getLinesFromFile(logFile, lines);
+
+		for (IntelWeb::Engine engine : { IntelWeb::HASH, IntelWeb::PAGED, IntelWeb::LSM })
+		{
+			cout << "scale " << scale << " (" << lines.size() << " lines), " << engineName(engine) << "..." << endl;
+			size_t ingestIndex = results.size() + 1;	// right after createNew
+			if (!benchmarkDataset(scale, engine, logFile, lines.size(), indicators, results))
+				return false;
+			const Measurement& ingest = results[ingestIndex];
+			cout << "  ingest: " << ingest.items / total(ingest.samples) << " lines/s" << endl;
+		}
+	}
+
+	writeResults(resultsPrefix, results);
+	cout << "Wrote " << resultsPrefix << ".json and " << resultsPrefix << ".csv" << endl;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// -h: compare DiskMultiMap's hash functions on generated entity names
+//////////////////////////////////////////////////////////////////////////
+
+bool benchmarkHashes(string sourcesFile, string maliciousFile, int scale)
+{
+	vector<string> goodSources, maliciousLogs;
+	if (!getLinesFromFile(sourcesFile, goodSources) || goodSources.empty() ||
+		!getLinesFromFile(maliciousFile, maliciousLogs) || maliciousLogs.empty())
+	{
+		cout << "Error: can't open " << sourcesFile << " or " << maliciousFile << endl;
+		return false;
+	}
+	string logFile = "p4bench-" + to_string(scale) + ".txt";
+	if (!generateLog(goodSources, maliciousLogs, scale, logFile))
+	{
+		cout << "Error: problem generating logs" << endl;
+		return false;
+	}
+
+	// the keys IntelWeb actually stores: every distinct initiator and target
+	vector<string> lines;
+	getLinesFromFile(logFile, lines);
+	set<string> entities;
+	for (const auto& line : lines)
+	{
+		istringstream iss(line);
+		string machine, from, to;
+		if (iss >> machine >> from >> to)
+		{
+			entities.insert(from);
+			entities.insert(to);
+		}
+	}
+	vector<string> keys(entities.begin(), entities.end());
+	size_t totalLength = 0;
+	for (const auto& key : keys)
+		totalLength += key.size();
+	unsigned int numBuckets = static_cast<unsigned int>(keys.size() * (4.0 / 3.0));	// same load factor as IntelWeb
+	cout << keys.size() << " keys, mean length " << static_cast<double>(totalLength) / keys.size()
+		<< ", " << numBuckets << " buckets" << endl;
+	cout << "hash	ns/key	emptyBuckets%	maxChain	searches/s	keyTuplesRead/search" << endl;
+
+	for (int f = 0; f < NUM_HASH_FUNCTIONS; f++)
+	{
+		HashFunction hashFunction = HashFunction(f);
+		KeyHasher hasher = keyHasher(hashFunction);
+
+		// raw hashing cost
+		uint64_t sink = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int r = 0; r < HASH_ROUNDS; r++)
+			for (const auto& key : keys)
+				sink += hasher(key.data(), key.size());
+		hashSink = sink;
+		double nsPerKey = secondsSince(start) * 1e9 / (static_cast<double>(HASH_ROUNDS) * keys.size());
+
+		// how evenly the keys land in DiskMultiMap's buckets
+		vector<unsigned int> chains(numBuckets, 0);
+		for (const auto& key : keys)
+			chains[hasher(key.data(), key.size()) % numBuckets]++;
+		size_t empty = count(chains.begin(), chains.end(), 0u);
+		unsigned int maxChain = *max_element(chains.begin(), chains.end());
+
+		// end to end: a search per key against a real file, so chain length shows up as extra reads
+		string file = string("p4bench-hash-") + hashName(hashFunction) + ".dmm";
+		DiskMultiMap map;
+		if (!map.createNew(file, numBuckets, hashFunction))
+		{
+			cout << "Error: Cannot create " << file << endl;
+			return false;
+		}
+		for (const auto& key : keys)
+			map.insert(key, "v", "c");
+		Stats before = map.stats();
+		start = chrono::steady_clock::now();
+		size_t found = 0;
+		for (const auto& key : keys)
+			if (map.search(key).isValid())
+				found++;
+		double searchSeconds = secondsSince(start);
+		Stats after = map.stats();
+		map.close();
+		if (found != keys.size())
+		{
+			cout << "Error: " << hashName(hashFunction) << " found " << found << " of " << keys.size() << " keys" << endl;
+			return false;
+		}
+		double keyTuplesPerSearch = static_cast<double>(after.searchChain.sum - before.searchChain.sum) / keys.size();
+
+		cout << hashName(hashFunction) << "\t" << nsPerKey << "\t" << 100.0 * empty / numBuckets << "\t" << maxChain
+			<< "\t" << keys.size() / searchSeconds << "\t" << keyTuplesPerSearch << endl;
+	}
+	cout << "(a uniform hash leaves " << 100.0 * exp(-static_cast<double>(keys.size()) / numBuckets) << "% of buckets empty)" << endl;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// -l: chained buckets vs bucket pages at increasing load factors
+//////////////////////////////////////////////////////////////////////////
+
+struct SearchCost
+{
+	double perSecond;
+	double readsPerSearch;
+	double keysPerSearch;	// KeyTuples read, including fingerprint collisions
+};
+
+SearchCost timeSearches(DiskMultiMap& map, const vector<string>& keys, bool expectFound)
+{
+	Stats before = map.stats();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	size_t found = 0;
+	for (const auto& key : keys)
+		if (map.search(key).isValid())
+			found++;
+	SearchCost cost;
+	cost.perSecond = keys.size() / secondsSince(start);
+	Stats after = map.stats();
+	cost.readsPerSearch = static_cast<double>(after.io.reads - before.io.reads) / keys.size();
+	cost.keysPerSearch = static_cast<double>(after.searchChain.sum - before.searchChain.sum) / keys.size();
+	if (found != (expectFound ? keys.size() : 0))
+		cout << "Error: found " << found << " of " << keys.size() << " keys, expected " << (expectFound ? keys.size() : 0) << endl;
+	return cost;
+}
+
+bool benchmarkLayouts(int numKeys)
+{
+	// short random names like p4gen's file names; misses use a prefix no present key has
+	LogRandom rng(BENCH_SEED);
+	vector<string> present, absent;
+	for (int i = 0; i < numKeys; i++)
+	{
+		string name;
+		int length = 6 + rng.nextInt(15);
+		for (int c = 0; c < length; c++)
+			name += static_cast<char>('a' + rng.nextInt(26));
+		present.push_back(name + to_string(i) + ".exe");
+		absent.push_back("~" + name + to_string(i) + ".exe");
+	}
+
+	cout << numKeys << " keys" << endl;
+	cout << "loadFactor\tlayout\tinsert/s\thit/s\treads/hit\tkeys/hit\tmiss/s\treads/miss\tkeys/miss\tfileBytes" << endl;
+	for (double loadFactor : LAYOUT_LOAD_FACTORS)
+	{
+		unsigned int slots = max(1u, static_cast<unsigned int>(numKeys / loadFactor));
+		for (DiskMultiMap::Layout layout : { DiskMultiMap::CHAINED, DiskMultiMap::PAGED })
+		{
+			const char* name = layout == DiskMultiMap::PAGED ? "paged" : "chained";
+			string file = string("p4bench-layout-") + name + ".dmm";
+			DiskMultiMap map;
+			if (!map.createNew(file, slots, DEFAULT_HASH_FUNCTION, layout))
+			{
+				cout << "Error: Cannot create " << file << endl;
+				return false;
+			}
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (const auto& key : present)
+				map.insert(key, "m1", "m1");
+			double insertRate = numKeys / secondsSince(start);
+			SearchCost hit = timeSearches(map, present, true);
+			SearchCost miss = timeSearches(map, absent, false);
+			DiskMultiMap::Analysis analysis;
+			map.analyze(analysis, 0);
+			cout << loadFactor << "\t" << name << "\t" << insertRate << "\t" << hit.perSecond << "\t" << hit.readsPerSearch
+				<< "\t" << hit.keysPerSearch << "\t" << miss.perSecond << "\t" << miss.readsPerSearch << "\t" << miss.keysPerSearch
+				<< "\t" << analysis.fileBytes << endl;
+		}
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// -q: crawl throughput against the number of reads in flight
+//////////////////////////////////////////////////////////////////////////
+
+struct ExpandResult
+{
+	size_t lookups, values;
+	double seconds;
+	uint64_t reads;
+};
+
+// expands outwards from the indicators like crawl (without the prevalence cut-off) one level at a time,
+// looking each level up in both maps with searchBatch, or with search() and an Iterator if queueDepth is 0
+bool expandFrontier(DiskMultiMap& initiators, DiskMultiMap& targets, const vector<string>& indicators, unsigned int queueDepth, ExpandResult& result)
+{
+	set<string> seen(indicators.begin(), indicators.end());
+	vector<string> level(seen.begin(), seen.end());
+	Stats before = initiators.stats();
+	before.merge(targets.stats());
+	result.lookups = result.values = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	while (!level.empty() && result.lookups < MAX_QUEUE_LOOKUPS)
+	{
+		if (level.size() > MAX_QUEUE_LOOKUPS - result.lookups)
+			level.resize(MAX_QUEUE_LOOKUPS - result.lookups);
+		vector<string> next;
+		for (DiskMultiMap* map : { &initiators, &targets })
+		{
+			vector<vector<MultiMapTuple>> found;
+			if (queueDepth > 0)
+			{
+				if (!map->searchBatch(level, found, queueDepth))
+					return false;
+			}
+			else
+			{
+				found.resize(level.size());
+				for (size_t i = 0; i < level.size(); i++)
+					for (DiskMultiMap::Iterator it = map->search(level[i]); it.isValid(); ++it)
+						found[i].push_back(*it);
+			}
+			for (const auto& values : found)
+				for (const auto& m : values)
+				{
+					result.values++;
+					if (seen.insert(m.value).second)
+						next.push_back(m.value);
+				}
+		}
+		result.lookups += level.size();
+		level.swap(next);
+	}
+	result.seconds = secondsSince(start);
+	Stats after = initiators.stats();
+	after.merge(targets.stats());
+	result.reads = after.io.reads - before.io.reads;
+	return true;
+}
+
+bool benchmarkQueueDepths(string prefix, string indicatorFile, const vector<unsigned int>& depths)
+{
+	vector<string> indicators;
+	if (!getLinesFromFile(indicatorFile, indicators) || indicators.empty())
+	{
+		cout << "Error: Cannot read indicators file " << indicatorFile << endl;
+		return false;
+	}
+	string files[] = { prefix + "-initiator.dmm", prefix + "-target.dmm" };
+	DiskMultiMap initiators, targets;
+	if (!initiators.openExisting(files[0]) || !targets.openExisting(files[1]))
+	{
+		cout << "Error: Cannot open " << files[0] << " and " << files[1] << " (p4bench -q needs a hash or paged database)" << endl;
+		return false;
+	}
+
+	// dropping the files from the OS cache before every run makes the reads go to the device, which is where depth pays off
+	bool cold = AsyncFile::evictFromCache(files[0]) && AsyncFile::evictFromCache(files[1]);
+	cout << (cold ? "cold cache (files evicted before each run)" : "warm cache (this platform can't evict the files)") << endl;
+	cout << "queueDepth\tbackend\tlookups\tlookups/s\tvalues/s\treads\tspeedup" << endl;
+	double baseline = 0;
+	for (size_t i = 0; i <= depths.size(); i++)
+	{
+		unsigned int depth = i == 0 ? 0 : depths[i - 1];	// 0: search() and Iterator, one read at a time
+		if (cold)
+		{
+			AsyncFile::evictFromCache(files[0]);
+			AsyncFile::evictFromCache(files[1]);
+		}
+		ExpandResult result;
+		if (!expandFrontier(initiators, targets, indicators, depth, result))
+		{
+			cout << "Error: batched search failed at queue depth " << depth << endl;
+			return false;
+		}
+		double rate = result.lookups / result.seconds;
+		if (i == 0)
+			baseline = rate;
+		cout << (depth == 0 ? string("sync") : to_string(depth)) << "\t" << (depth == 0 ? "fstream" : initiators.asyncBackend())
+			<< "\t" << result.lookups << "\t" << rate << "\t" << result.values / result.seconds << "\t" << result.reads
+			<< "\t" << rate / baseline << endl;
+	}
+	initiators.close();
+	targets.close();
+
+	// the same depths as IntelWeb::crawl's concurrency, which has to find exactly what the one-at-a-time crawl finds
+	IntelWeb iw;
+	if (!iw.openExisting(prefix))
+	{
+		cout << "Error: Cannot open existing database with prefix " << prefix << endl;
+		return false;
+	}
+	const unsigned int minGoodPrevalence = CRAWL_PREVALENCES[1];
+	cout << "crawl (minGoodPrevalence " << minGoodPrevalence << ")" << endl;
+	cout << "concurrency\tseconds\tbadEntities\tinteractions\tspeedup\tsameResults" << endl;
+	vector<string> expectedEntities;
+	vector<InteractionTuple> expectedInteractions;
+	double baseSeconds = 0;
+	for (size_t i = 0; i <= depths.size(); i++)
+	{
+		unsigned int concurrency = i == 0 ? 1 : depths[i - 1];
+		if (i > 0 && concurrency == 1)
+			continue;	// already measured as the sequential crawl
+		if (cold)
+		{
+			AsyncFile::evictFromCache(files[0]);
+			AsyncFile::evictFromCache(files[1]);
+		}
+		vector<string> badEntities;
+		vector<InteractionTuple> interactions;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		iw.crawl(indicators, minGoodPrevalence, badEntities, interactions, concurrency);
+		double seconds = secondsSince(start);
+		if (i == 0)
+		{
+			baseSeconds = seconds;
+			expectedEntities = badEntities;
+			expectedInteractions = interactions;
+		}
+		bool same = badEntities == expectedEntities && interactions.size() == expectedInteractions.size();
+		for (size_t j = 0; same && j < interactions.size(); j++)
+			same = interactions[j].from == expectedInteractions[j].from && interactions[j].to == expectedInteractions[j].to &&
+				interactions[j].context == expectedInteractions[j].context;
+		cout << (i == 0 ? string("1 (sequential)") : to_string(concurrency)) << "\t" << seconds << "\t" << badEntities.size()
+			<< "\t" << interactions.size() << "\t" << baseSeconds / seconds << "\t" << (same ? "yes" : "NO") << endl;
+		if (!same)
+			return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// -m: crawl snapshots while another thread ingests and purges
+//////////////////////////////////////////////////////////////////////////
+
+struct CrawlResult
+{
+	vector<string> badEntities;
+	vector<InteractionTuple> interactions;
+};
+
+bool sameResults(const CrawlResult& a, const CrawlResult& b)
+{
+	if (a.badEntities != b.badEntities || a.interactions.size() != b.interactions.size())
+		return false;
+	for (size_t i = 0; i < a.interactions.size(); i++)
+		if (a.interactions[i].from != b.interactions[i].from || a.interactions[i].to != b.interactions[i].to ||
+			a.interactions[i].context != b.interactions[i].context)
+			return false;
+	return true;
+}
+
+// the writer alternates between ingesting the next chunk of the log and purging that chunk's first initiator,
+// so snapshots see chains relinked and slots freed as well as appends; each step that changes the database commits one generation
+bool stressStep(IntelWeb& iw, const vector<string>& lines, size_t step, const string& chunkFile)
+{
+	size_t first = (step / 2) * STRESS_CHUNK_LINES;
+	if (step % 2 == 1)
+	{
+		istringstream iss(lines[first]);
+		string context, initiator;
+		iss >> context >> initiator;
+		iw.purge(initiator);
+		return true;
+	}
+	ofstream chunk(chunkFile);
+	for (size_t i = first; i < min(lines.size(), first + STRESS_CHUNK_LINES); i++)
+		chunk << lines[i] << '\n';
+	chunk.close();
+	return chunk && iw.ingest(chunkFile);
+}
+
+struct StressSamples
+{
+	mutex lock;
+	map<uint32_t, CrawlResult> byGeneration;	// the first crawl of each generation seen
+	size_t crawls = 0, disagreements = 0, failedOpens = 0;
+};
+
+// crawls fresh snapshots of live until the writer is done, checking that crawls of the same generation agree
+void crawlSnapshots(IntelWeb& live, const vector<string>& indicators, unsigned int minGoodPrevalence, unsigned int concurrency,
+	const atomic<bool>& writerDone, StressSamples& samples)
+{
+	do
+	{
+		IntelWeb snapshot;
+		if (!snapshot.openSnapshot(live))
+		{
+			lock_guard<mutex> guard(samples.lock);
+			samples.failedOpens++;
+			continue;
+		}
+		CrawlResult result;
+		snapshot.crawl(indicators, minGoodPrevalence, result.badEntities, result.interactions, concurrency);
+		uint32_t generation = snapshot.generation();
+		snapshot.close();
+
+		lock_guard<mutex> guard(samples.lock);
+		samples.crawls++;
+		map<uint32_t, CrawlResult>::iterator it = samples.byGeneration.find(generation);
+		if (it == samples.byGeneration.end())
+			samples.byGeneration[generation] = result;
+		else if (!sameResults(it->second, result))
+			samples.disagreements++;
+	} while (!writerDone);
+}
+
+bool stressEngine(IntelWeb::Engine engine, const vector<string>& lines, const vector<string>& indicators,
+	unsigned int minGoodPrevalence, unsigned int numReaders)
+{
+	string prefix = string("p4bench-stress-") + engineName(engine);
+	size_t steps = 2 * ((lines.size() + STRESS_CHUNK_LINES - 1) / STRESS_CHUNK_LINES);
+	IntelWeb live;
+	if (!live.createNew(prefix, (unsigned int)lines.size(), engine))
+	{
+		cout << "Error: Cannot create database with prefix " << prefix << endl;
+		return false;
+	}
+
+	uint32_t startGeneration = live.generation();
+	vector<uint32_t> generations(steps);	// after each step
+	StressSamples samples;
+	atomic<bool> writerDone(false);
+	vector<thread> readers;
+	for (unsigned int i = 0; i < numReaders; i++)
+		readers.push_back(thread(crawlSnapshots, ref(live), cref(indicators), minGoodPrevalence,
+			i % 2 ? STRESS_CRAWL_CONCURRENCY : 1u, cref(writerDone), ref(samples)));
+	bool ok = true;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; ok && i < steps; i++)
+	{
+		ok = stressStep(live, lines, i, prefix + "-chunk.txt");
+		generations[i] = live.generation();
+	}
+	double writerSeconds = secondsSince(start);
+	writerDone = true;
+	for (thread& reader : readers)
+		reader.join();
+	if (!ok)
+	{
+		cout << "Error: ingest or purge failed on " << prefix << endl;
+		return false;
+	}
+	PageVersions::Counters counters = live.snapshotCounters();
+	Stats stats = live.stats();
+	live.close();
+
+	// the same steps with nothing reading: the database at every generation a snapshot saw is crawled and compared
+	IntelWeb reference;
+	if (!reference.createNew(prefix + "-reference", (unsigned int)lines.size(), engine))
+	{
+		cout << "Error: Cannot create database with prefix " << prefix << "-reference" << endl;
+		return false;
+	}
+	size_t verified = 0, wrong = 0;
+	double aloneSeconds = 0;
+	for (size_t i = 0; i <= steps; i++)
+	{
+		if (i > 0)
+		{
+			start = chrono::steady_clock::now();
+			if (!stressStep(reference, lines, i - 1, prefix + "-chunk.txt"))
+			{
+				cout << "Error: ingest or purge failed on " << prefix << "-reference" << endl;
+				return false;
+			}
+			aloneSeconds += secondsSince(start);
+		}
+		map<uint32_t, CrawlResult>::const_iterator seen = samples.byGeneration.find(i == 0 ? startGeneration : generations[i - 1]);
+		if (seen == samples.byGeneration.end())
+			continue;
+		CrawlResult expected;
+		reference.crawl(indicators, minGoodPrevalence, expected.badEntities, expected.interactions);
+		verified++;
+		if (!sameResults(expected, seen->second))
+			wrong++;
+	}
+
+	cout << engineName(engine) << "\t" << steps << "\t" << writerSeconds << "\t" << aloneSeconds << "\t" << samples.crawls << "\t"
+		<< samples.byGeneration.size() << "\t" << verified << "\t" << counters.pinWaits << "\t" << counters.pagesCopied << "\t"
+		<< counters.maxBytesHeld / 1024 << "\t" << stats.reuseDeferred << "\t" << wrong + samples.disagreements + samples.failedOpens << endl;
+	if (verified != samples.byGeneration.size())
+		cout << "Error: " << samples.byGeneration.size() - verified << " snapshot generations don't match a writer step" << endl;
+	return verified == samples.byGeneration.size() && wrong == 0 && samples.disagreements == 0 && samples.failedOpens == 0;
+}
+
+// an ingest that fails partway (its third line's initiator is too long to insert) still has to commit what it wrote before the failure,
+// or every snapshot opened afterwards waits forever for that generation; with shards, the failure surfaces when the writers are drained
+bool stressFailedIngest(IntelWeb::Engine engine, const vector<string>& lines, unsigned int numShards)
+{
+	string prefix = string("p4bench-stress-failed-") + engineName(engine) + "-" + to_string(numShards);
+	vector<string> shardPrefixes;
+	for (unsigned int k = 0; numShards > 1 && k < numShards; k++)
+		shardPrefixes.push_back(prefix + "-" + to_string(k));
+	// leaked if the snapshot never opens, since the reader blocked on it can't be stopped
+	IntelWeb* live = new IntelWeb;
+	if (!live->createNew(prefix, (unsigned int)lines.size(), engine, DEFAULT_HASH_FUNCTION, shardPrefixes))
+	{
+		cout << "Error: Cannot create database with prefix " << prefix << endl;
+		delete live;
+		return false;
+	}
+	string chunkFile = prefix + "-chunk.txt";
+	ofstream chunk(chunkFile);
+	for (size_t i = 0; i < min(lines.size(), STRESS_CHUNK_LINES); i++)
+	{
+		if (i == 2)
+			chunk << "m0 " << string(130, 'x') << " bad.exe" << '\n';
+		chunk << lines[i] << '\n';
+	}
+	chunk.close();
+	uint32_t before = live->generation();
+	bool ingested = !chunk || live->ingest(chunkFile);
+
+	shared_ptr<atomic<int64_t> > pinned = make_shared<atomic<int64_t> >(-1);	// -1 while opening, -2 if it failed, else the generation
+	thread reader([live, pinned]()
+	{
+		IntelWeb snapshot;
+		*pinned = snapshot.openSnapshot(*live) ? int64_t(snapshot.generation()) : -2;
+	});
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	while (*pinned == -1 && secondsSince(start) < STRESS_PIN_TIMEOUT_SECONDS)
+		this_thread::sleep_for(chrono::milliseconds(10));
+	int64_t generation = *pinned;
+	if (generation == -1)
+	{
+		reader.detach();
+		cout << "Error: a snapshot of " << prefix << " still hasn't opened " << STRESS_PIN_TIMEOUT_SECONDS << "s after a failed ingest" << endl;
+		return false;
+	}
+	reader.join();
+	uint32_t after = live->generation();
+	delete live;
+
+	cout << engineName(engine) << "\t" << numShards << "\t" << (ingested ? "succeeded" : "failed") << "\t" << generation << endl;
+	if (ingested || generation != int64_t(after) || after <= before)
+	{
+		cout << "Error: the failed ingest on " << prefix << " should return false and commit what it wrote" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool stressSnapshots(string telemetryFile, string indicatorFile, unsigned int minGoodPrevalence, unsigned int numReaders)
+{
+	vector<string> lines, indicators;
+	if (!getLinesFromFile(telemetryFile, lines) || lines.empty())
+	{
+		cout << "Error: Cannot read telemetry file " << telemetryFile << endl;
+		return false;
+	}
+	if (!getLinesFromFile(indicatorFile, indicators) || indicators.empty())
+	{
+		cout << "Error: Cannot read indicators file " << indicatorFile << endl;
+		return false;
+	}
+	cout << numReaders << " readers crawling snapshots (minGoodPrevalence " << minGoodPrevalence << ") while one thread ingests "
+		<< STRESS_CHUNK_LINES << "-line chunks and purges" << endl;
+	cout << "engine\tsteps\twriter(s)\talone(s)\tcrawls\tgenerations\tverified\tpinWaits\tpagesCopied\tmaxKeptKB\treuseDeferred\terrors" << endl;
+	bool ok = true;
+	for (IntelWeb::Engine engine : { IntelWeb::HASH, IntelWeb::PAGED })
+		ok = stressEngine(engine, lines, indicators, minGoodPrevalence, numReaders) && ok;
+	cout << "snapshots after an ingest that fails on its third line" << endl;
+	cout << "engine\tshards\tingest\tsnapshot generation" << endl;
+	for (IntelWeb::Engine engine : { IntelWeb::HASH, IntelWeb::PAGED })
+		for (unsigned int numShards : { 1u, 2u })
+			ok = stressFailedIngest(engine, lines, numShards) && ok;
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// -f: ingest throughput of the text and binary telemetry formats
+//////////////////////////////////////////////////////////////////////////
+
+// tokenizes the log the way IntelWeb::ingest does, without storing anything
+bool parseText(const string& telemetryFile, size_t& events, size_t& lengthSum)
+{
+	ifstream inf(telemetryFile);
+	if (!inf)
+		return false;
+	string line;
+	events = lengthSum = 0;
+	while (getline(inf, line))
+	{
+		istringstream iss(line);
+		string context, initiator, target;
+		if (!(iss >> context >> initiator >> target))
+			continue;
+		events++;
+		lengthSum += context.size() + initiator.size() + target.size();
+	}
+	return true;
+}
+
+// decodes every block the way IntelWeb::ingest does, without storing anything
+bool decodeBinary(const string& binaryFile, size_t& events, size_t& lengthSum)
+{
+	TelemetryFile::Reader reader;
+	if (!reader.open(binaryFile))
+		return false;
+	TelemetryFile::Block block;
+	events = lengthSum = 0;
+	for (uint32_t b = 0; b < reader.blocks(); b++)
+	{
+		if (!reader.readBlock(b, block))
+			return false;
+		for (unsigned int i = 0; i < block.events; i++)
+			lengthSum += block.name(TelemetryFile::CONTEXT, i).size() + block.name(TelemetryFile::INITIATOR, i).size() + block.name(TelemetryFile::TARGET, i).size();
+		events += block.events;
+	}
+	return true;
+}
+
+// seconds to ingest telemetryFile into a new database, including close() so the LSM engine's final flush is counted
+bool timeIngest(IntelWeb::Engine engine, const string& telemetryFile, unsigned int numItems, double& seconds)
+{
+	string prefix = string("p4bench-format-") + engineName(engine);
+	IntelWeb iw;
+	if (!iw.createNew(prefix, numItems, engine))
+	{
+		cout << "Error: Cannot create database with prefix " << prefix << endl;
+		return false;
+	}
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (!iw.ingest(telemetryFile))
+	{
+		cout << "Error: Ingesting telemetry data from " << telemetryFile << " failed." << endl;
+		return false;
+	}
+	iw.close();
+	seconds = secondsSince(start);
+	return true;
+}
+
+bool benchmarkFormats(string telemetryFile, unsigned int numItems)
+{
+	string binaryFile = "p4bench-telemetry.bin";
+	uint64_t badLines;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (!TelemetryFile::convert(telemetryFile, binaryFile, badLines))
+	{
+		cout << "Error: Cannot convert " << telemetryFile << " to " << binaryFile << endl;
+		return false;
+	}
+	double convertSeconds = secondsSince(start);
+
+	// both formats must hand ingest the same names
+	size_t textEvents, textLengths, binaryEvents, binaryLengths;
+	start = chrono::steady_clock::now();
+	if (!parseText(telemetryFile, textEvents, textLengths))
+	{
+		cout << "Error: Cannot read telemetry file " << telemetryFile << endl;
+		return false;
+	}
+	double textParseSeconds = secondsSince(start);
+	start = chrono::steady_clock::now();
+	if (!decodeBinary(binaryFile, binaryEvents, binaryLengths))
+	{
+		cout << "Error: Cannot read " << binaryFile << endl;
+		return false;
+	}
+	double binaryParseSeconds = secondsSince(start);
+	if (textEvents != binaryEvents || textLengths != binaryLengths)
+	{
+		cout << "Error: " << binaryFile << " has " << binaryEvents << " events, but " << telemetryFile << " has " << textEvents << endl;
+		return false;
+	}
+
+	ifstream textf(telemetryFile, ios::binary | ios::ate), binaryf(binaryFile, ios::binary | ios::ate);
+	double textMB = static_cast<double>(textf.tellg()) / (1 << 20), binaryMB = static_cast<double>(binaryf.tellg()) / (1 << 20);
+	cout << textEvents << " events (" << badLines << " bad lines skipped), converted in " << convertSeconds << "s ("
+		<< textMB / convertSeconds << " MB/s of text)" << endl;
+	cout << "format	MB	parse(events/s)";
+	for (IntelWeb::Engine engine : { IntelWeb::HASH, IntelWeb::PAGED, IntelWeb::LSM })
+		cout << "	" << engineName(engine) << "(events/s)";
+	cout << endl;
+	for (int binary = 0; binary < 2; binary++)
+	{
+		cout << (binary ? "binary" : "text") << "	" << (binary ? binaryMB : textMB) << "	"
+			<< textEvents / (binary ? binaryParseSeconds : textParseSeconds);
+		for (IntelWeb::Engine engine : { IntelWeb::HASH, IntelWeb::PAGED, IntelWeb::LSM })
+		{
+			double seconds;
+			if (!timeIngest(engine, binary ? binaryFile : telemetryFile, numItems, seconds))
+				return false;
+			cout << "	" << textEvents / seconds;
+		}
+		cout << endl;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// -d: ingest and crawl with the maps split across shards (on several disks if directories are given)
+//////////////////////////////////////////////////////////////////////////
+
+// evicts every .dmm file of the database, so the crawl that follows reads from the devices
+bool evictDatabase(const string& prefix)
+{
+	bool evicted = true;
+	for (const string& shardPrefix : IntelWeb::shardPrefixes(prefix))
+		evicted = AsyncFile::evictFromCache(shardPrefix + "-initiator.dmm") && AsyncFile::evictFromCache(shardPrefix + "-target.dmm") && evicted;
+	return evicted;
+}
+
+bool benchmarkShards(string telemetryFile, string indicatorFile, unsigned int minGoodPrevalence, unsigned int numItems,
+	unsigned int maxShards, const vector<string>& directories)
+{
+	vector<string> indicators;
+	if (!getLinesFromFile(indicatorFile, indicators) || indicators.empty())
+	{
+		cout << "Error: Cannot read indicators file " << indicatorFile << endl;
+		return false;
+	}
+	size_t events, lengthSum;
+	if (!parseText(telemetryFile, events, lengthSum))
+	{
+		cout << "Error: Cannot read telemetry file " << telemetryFile << endl;
+		return false;
+	}
+	// the writer threads only run at once with a core each; with fewer cores than shards the speedup measures the disks at best
+	unsigned int cores = thread::hardware_concurrency();
+	cout << events << " events, shards spread over " << max<size_t>(1, directories.size()) << " director"
+		<< (directories.size() > 1 ? "ies" : "y") << ", " << cores << " core" << (cores == 1 ? "" : "s") << endl;
+	if (cores < maxShards + 1)
+		cout << "(ingest uses a thread per shard plus the parsing thread, so above " << (cores > 1 ? cores - 1 : 1)
+			<< " shard" << (cores > 2 ? "s" : "") << " the speedup isn't a measure of scaling)" << endl;
+	cout << "shards	ingest(events/s)	speedup	commits	crawl(s)	crawl" << SHARD_CRAWL_CONCURRENCY << "(s)	cold	sameResults" << endl;
+	CrawlResult expected;
+	double baseRate = 0;
+	for (unsigned int shards = 1; shards <= maxShards; shards *= 2)
+	{
+		// shard k goes in directory k % directories.size(), so consecutive shards are on different disks
+		string prefix = "p4bench-shards-" + to_string(shards);
+		vector<string> shardPrefixes;
+		for (unsigned int k = 0; k < shards; k++)
+			shardPrefixes.push_back((directories.empty() ? string() : directories[k % directories.size()] + "/") + prefix + "-" + to_string(k));
+		IntelWeb iw;
+		if (!iw.createNew(prefix, numItems, IntelWeb::HASH, DEFAULT_HASH_FUNCTION, shardPrefixes))
+		{
+			cout << "Error: Cannot create database with prefix " << prefix << endl;
+			return false;
+		}
+		// each commit drains every shard's queue; with no snapshot open ingest should only commit at the end
+		uint32_t generation = iw.generation();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (!iw.ingest(telemetryFile))
+		{
+			cout << "Error: Ingesting telemetry data from " << telemetryFile << " failed." << endl;
+			return false;
+		}
+		uint32_t commits = iw.generation() - generation;
+		iw.close();
+		double rate = events / secondsSince(start);
+		if (shards == 1)
+			baseRate = rate;
+
+		if (!iw.openExisting(prefix))
+		{
+			cout << "Error: Cannot open existing database with prefix " << prefix << endl;
+			return false;
+		}
+		double seconds[2];
+		bool cold = true, same = true;
+		for (int c = 0; c < 2; c++)
+		{
+			cold = evictDatabase(prefix) && cold;
+			CrawlResult result;
+			start = chrono::steady_clock::now();
+			iw.crawl(indicators, minGoodPrevalence, result.badEntities, result.interactions, c == 0 ? 1 : SHARD_CRAWL_CONCURRENCY);
+			seconds[c] = secondsSince(start);
+			if (shards == 1 && c == 0)
+				expected = result;
+			same = same && sameResults(expected, result);
+		}
+		cout << shards << "\t" << rate << "\t" << rate / baseRate << "\t" << commits << "\t" << seconds[0] << "\t" << seconds[1] << "\t"
+			<< (cold ? "yes" : "no") << "\t" << (same ? "yes" : "NO") << endl;
+		if (!same)
+			return false;
+	}
+	return true;
+}
+
+void printUsageAndExit()
+{
+	cout << "Usage:" << endl;
+	cout << "  p4bench -c telemetryLogfile indicators minGoodPrevalence expectedNumberOfItems" << endl;
+	cout << "  p4bench -s sources.txt malicious.txt resultsPrefix [numEvents...]" << endl;
+	cout << "  p4bench -h sources.txt malicious.txt [numEvents]" << endl;
+	cout << "  p4bench -l [numKeys]" << endl;
+	cout << "  p4bench -q databasePrefix indicators [queueDepth...]" << endl;
+	cout << "  p4bench -m telemetryLogfile indicators minGoodPrevalence [readers]" << endl;
+	cout << "  p4bench -f telemetryLogfile expectedNumberOfItems" << endl;
+	cout << "  p4bench -d telemetryLogfile indicators minGoodPrevalence expectedNumberOfItems [maxShards [directory...]]" << endl;
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || argv[1][0] != '-')
+		printUsageAndExit();
+	switch (argv[1][1])
+	{
+	case 'c':
+		if (argc != 6)
+			printUsageAndExit();
+		if (!compareEngines(argv[2], argv[3], atoi(argv[4]), atoi(argv[5])))
+			return 1;
+		break;
+	case 's':
+	{
+		if (argc < 5)
+			printUsageAndExit();
+		vector<int> scales;
+		for (int i = 5; i < argc; i++)
+		{
+			if (atoi(argv[i]) <= 0)
+				printUsageAndExit();
+			scales.push_back(atoi(argv[i]));
+		}
+		if (scales.empty())
+			scales.assign(begin(DEFAULT_SCALES), end(DEFAULT_SCALES));
+		if (!runSuite(argv[2], argv[3], argv[4], scales))
+			return 1;
+		break;
+	}
+	case 'h':
+	{
+		if (argc != 4 && argc != 5)
+			printUsageAndExit();
+		int scale = argc == 5 ? atoi(argv[4]) : DEFAULT_HASH_SCALE;
+		if (scale <= 0)
+			printUsageAndExit();
+		if (!benchmarkHashes(argv[2], argv[3], scale))
+			return 1;
+		break;
+	}
+	case 'l':
+	{
+		if (argc > 3)
+			printUsageAndExit();
+		int numKeys = argc == 3 ? atoi(argv[2]) : DEFAULT_LAYOUT_KEYS;
+		if (numKeys <= 0)
+			printUsageAndExit();
+		if (!benchmarkLayouts(numKeys))
+			return 1;
+		break;
+	}
+	case 'q':
+	{
+		if (argc < 4)
+			printUsageAndExit();
+		vector<unsigned int> depths;
+		for (int i = 4; i < argc; i++)
+		{
+			if (atoi(argv[i]) <= 0)
+				printUsageAndExit();
+			depths.push_back(atoi(argv[i]));
+		}
+		if (depths.empty())
+			depths.assign(begin(DEFAULT_QUEUE_DEPTHS), end(DEFAULT_QUEUE_DEPTHS));
+		if (!benchmarkQueueDepths(argv[2], argv[3], depths))
+			return 1;
+		break;
+	}
+	case 'm':
+	{
+		if (argc != 5 && argc != 6)
+			printUsageAndExit();
+		int readers = argc == 6 ? atoi(argv[5]) : DEFAULT_STRESS_READERS;
+		if (readers <= 0)
+			printUsageAndExit();
+		if (!stressSnapshots(argv[2], argv[3], atoi(argv[4]), readers))
+			return 1;
+		break;
+	}
+	case 'f':
+		if (argc != 4 || atoi(argv[3]) <= 0)
+			printUsageAndExit();
+		if (!benchmarkFormats(argv[2], atoi(argv[3])))
+			return 1;
+		break;
+	case 'd':
+	{
+		if (argc < 6 || atoi(argv[5]) <= 0)
+			printUsageAndExit();
+		int maxShards = argc >= 7 ? atoi(argv[6]) : DEFAULT_MAX_SHARDS;
+		if (maxShards <= 0)
+			printUsageAndExit();
+		vector<string> directories(argv + min(argc, 7), argv + argc);
+		if (!benchmarkShards(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]), maxShards, directories))
+			return 1;
+		break;
+	}
+	default:
+		printUsageAndExit();
+	}
+}
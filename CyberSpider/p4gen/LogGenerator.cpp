@@ -0,0 +1,292 @@
+#include "LogGenerator.h"
+#include "../CyberSpider/TelemetryFile.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+static uint64_t splitmix64(uint64_t& x)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+LogRandom::LogRandom(uint64_t seed)
+{
+	for (int i = 0; i < 4; i++)
+		s[i] = splitmix64(seed);
+}
+
+uint64_t LogRandom::next()
+{
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+unsigned int LogRandom::nextInt(unsigned int n)
+{
+	return static_cast<unsigned int>((next() >> 32) % n);
+}
+
+double LogRandom::nextDouble()
+{
+	return (next() >> 11) * (1.0 / 9007199254740992.0);	// 53 random bits
+}
+
+Popularity::Popularity(size_t n, double exponent)
+	: m_n(n)
+{
+	if (exponent <= 0 || n == 0)
+		return;
+	cdf.resize(n);
+	double sum = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		sum += 1.0 / pow(static_cast<double>(i + 1), exponent);
+		cdf[i] = sum;
+	}
+	for (size_t i = 0; i < n; i++)
+		cdf[i] /= sum;
+}
+
+size_t Popularity::sample(LogRandom& rng) const
+{
+	if (cdf.empty())
+		return rng.nextInt(static_cast<unsigned int>(m_n));
+	size_t i = upper_bound(cdf.begin(), cdf.end(), rng.nextDouble()) - cdf.begin();
+	return min(i, m_n - 1);
+}
+
+LogGenerator::LogGenerator(const vector<string>& goodSources, const vector<string>& maliciousLogs, const GeneratorOptions& options)
+	: m_goodSources(goodSources), m_maliciousLogs(maliciousLogs), m_options(options),
+	m_sources(goodSources.size(), options.zipfExponent), m_machines(options.numMachines, options.zipfExponent)
+{
+	for (const auto& src : goodSources)
+		m_isUrl.push_back(src.find("http://") != string::npos);
+
+	// generateTarget scans forward for a URL, so precompute where each scan ends
+	int n = static_cast<int>(goodSources.size());
+	m_nextUrl.assign(n, -1);
+	int next = -1;
+	for (int pass = 0; pass < 2; pass++)
+		for (int r = n - 1; r >= 0; r--)
+		{
+			if (m_isUrl[r])
+				next = r;
+			m_nextUrl[r] = next;
+		}
+
+	// malicious lines keep their order but are spread over random events
+	LogRandom rng(options.seed);
+	for (size_t j = 0; j < maliciousLogs.size(); j++)
+		m_maliciousEvents.push_back(rng.nextInt(options.numEvents));
+	sort(m_maliciousEvents.begin(), m_maliciousEvents.end());
+}
+
+void LogGenerator::generateFilename(LogRandom& rng, string& out) const
+{
+	const int MAX_FILENAME_LEN = 4;
+	const int length = rng.nextInt(MAX_FILENAME_LEN) + 1;
+
+	for (int i = 0; i < length; i++)
+		out += static_cast<char>('a' + rng.nextInt(26));
+}
+
+void LogGenerator::randomPath(LogRandom& rng, string& out) const
+{
+	int depthCategory = rng.nextInt(10);
+	int depth = depthCategory < 5 ? 1 :  // 50% depth 1
+		depthCategory < 8 ? 2 :  // 30% depth 2
+		depthCategory < 9 ? 3 :  // 10% depth 3
+		3 + rng.nextInt(4); // 2.5% each 3, 4, 5, 6
+
+	while (depth-- > 0)
+	{
+		out += '/';
+		generateFilename(rng, out);
+	}
+	out += '/';
+}
+
+void LogGenerator::generateSource(LogRandom& rng, string& out) const
+{
+	size_t r = m_sources.sample(rng);
+	out += m_goodSources[r];
+
+	if (m_isUrl[r])
+		randomPath(rng, out);  // URL
+}
+
+void LogGenerator::generateTarget(LogRandom& rng, string& out) const
+{
+	int r = m_nextUrl[m_sources.sample(rng)];
+	if (r == -1)
+	{
+		out += "http://ucla.edu";
+		randomPath(rng, out);
+		return;
+	}
+	out += m_goodSources[r];
+	randomPath(rng, out);
+}
+
+void LogGenerator::generateEvent(LogRandom& rng, string& out) const
+{
+	string curMachine = "m" + to_string(m_machines.sample(rng));
+	vector<string> exeFiles;
+
+	string baseExeName;
+	generateFilename(rng, baseExeName);
+	baseExeName += ".exe";
+	exeFiles.push_back(baseExeName);
+
+	out += curMachine; out += ' ';
+	generateSource(rng, out);
+	out += ' '; out += baseExeName; out += '\n';	// download event
+
+	int depth = rng.nextInt(5);
+	if (rng.nextInt(10) == 0)
+		depth *= 2;
+	while (depth-- > 0)
+	{
+		string newFile;
+		generateFilename(rng, newFile);
+		newFile += ".exe";
+		out += curMachine; out += ' ';
+		out += exeFiles[rng.nextInt(static_cast<unsigned int>(exeFiles.size()))];
+		out += ' '; out += newFile; out += '\n';	// create event
+		exeFiles.push_back(newFile);
+
+		if (rng.nextInt(2) == 0)
+		{
+			out += curMachine; out += ' ';
+			out += exeFiles[rng.nextInt(static_cast<unsigned int>(exeFiles.size()))];
+			out += ' ';
+			generateTarget(rng, out);
+			out += '\n';
+		}
+	}
+}
+
+void LogGenerator::generateChunk(size_t chunk, string& out) const
+{
+	// every chunk gets its own generator derived from the seed, so the output doesn't depend on which thread made it
+	uint64_t chunkSeed = m_options.seed ^ (0xD1B54A32D192ED03ULL * (chunk + 1));
+	LogRandom rng(chunkSeed);
+
+	int first = static_cast<int>(chunk) * EVENTS_PER_CHUNK;
+	int last = min(m_options.numEvents, first + EVENTS_PER_CHUNK);
+	size_t j = lower_bound(m_maliciousEvents.begin(), m_maliciousEvents.end(), first) - m_maliciousEvents.begin();
+	for (int e = first; e < last; e++)
+	{
+		for (; j < m_maliciousEvents.size() && m_maliciousEvents[j] == e; j++)
+		{
+			out += m_maliciousLogs[j];
+			out += '\n';
+		}
+		generateEvent(rng, out);
+	}
+}
+
+bool LogGenerator::generateLogs(const string& outputfile)
+{
+	// text chunks go straight to the file; in the binary format each chunk is split into events in memory and encoded, with no text file in between
+	ofstream outf;
+	TelemetryFile::Writer binf;
+	if (m_options.binary)
+	{
+		if (!binf.createNew(outputfile))
+			return false;
+	}
+	else
+	{
+		outf.open(outputfile, ios::binary);
+		if (!outf)
+			return false;
+	}
+
+	if (m_maliciousLogs.size() == 0 || m_goodSources.size() == 0 || m_options.numEvents <= 0 || m_options.numMachines <= 0)
+		return false;
+
+	size_t numChunks = (m_options.numEvents + EVENTS_PER_CHUNK - 1) / EVENTS_PER_CHUNK;
+	unsigned int numThreads = max(1u, m_options.numThreads);
+	size_t window = 2 * numThreads;	// chunks allowed to be generated ahead of the writer
+
+	// workers fill slots in any order; this thread writes them out in chunk order
+	vector<string> slots(window);
+	vector<bool> ready(window, false);
+	size_t nextChunk = 0, written = 0;
+	mutex m;
+	condition_variable cv;
+
+	auto worker = [&]() {
+		for (;;)
+		{
+			size_t chunk;
+			{
+				unique_lock<mutex> lock(m);
+				cv.wait(lock, [&]() { return nextChunk >= numChunks || nextChunk < written + window; });
+				if (nextChunk >= numChunks)
+					return;
+				chunk = nextChunk++;
+			}
+			string out;
+			generateChunk(chunk, out);
+			{
+				lock_guard<mutex> lock(m);
+				slots[chunk % window].swap(out);
+				ready[chunk % window] = true;
+			}
+			cv.notify_all();
+		}
+	};
+
+	vector<thread> threads;
+	for (unsigned int i = 0; i < numThreads; i++)
+		threads.push_back(thread(worker));
+
+	bool ok = true;
+	uint64_t badLines = 0;	// only malicious.txt lines that aren't three names
+	string out;
+	for (size_t c = 0; c < numChunks; c++)
+	{
+		{
+			unique_lock<mutex> lock(m);
+			cv.wait(lock, [&]() { return ready[c % window]; });
+			out.clear();
+			out.swap(slots[c % window]);
+			ready[c % window] = false;
+			written = c + 1;
+		}
+		cv.notify_all();
+		if (ok && m_options.binary)
+			ok = binf.appendText(out.data(), out.size(), badLines);
+		else if (ok && !outf.write(out.data(), out.size()))
+			ok = false;
+	}
+
+	for (auto& t : threads)
+		t.join();
+	if (m_options.binary && !binf.close())
+		ok = false;
+	return ok;
+}
@@ -0,0 +1,66 @@
+#ifndef LOGGENERATOR_H_
+#define LOGGENERATOR_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//telemetry generation used by p4gen, and by p4bench to build datasets in-process
+
+//xoshiro256** seeded through splitmix64; unlike rand() it gives the same sequence on every platform
+class LogRandom {
+public:
+	explicit LogRandom(uint64_t seed);
+	uint64_t next();
+	unsigned int nextInt(unsigned int n); //uniform in [0, n)
+	double nextDouble(); //uniform in [0, 1)
+private:
+	uint64_t s[4];
+};
+
+//picks an index in [0, n): uniformly when exponent is 0, otherwise Zipf so index 0 is the most popular
+class Popularity {
+public:
+	Popularity(size_t n, double exponent);
+	size_t sample(LogRandom& rng) const;
+private:
+	size_t m_n;
+	std::vector<double> cdf; //empty for the uniform distribution
+};
+
+struct GeneratorOptions {
+	GeneratorOptions() : numEvents(0), numMachines(0), seed(0), numThreads(1), zipfExponent(0), binary(false) {}
+	int numEvents;
+	int numMachines;
+	uint64_t seed; //the same seed gives the same log whatever numThreads is
+	unsigned int numThreads;
+	double zipfExponent; //popularity of sources and machines, 0 matches the original uniform generator
+	bool binary; //write the binary telemetry format (TelemetryFile.h) instead of text
+};
+
+class LogGenerator {
+public:
+	LogGenerator(const std::vector<std::string>& goodSources, const std::vector<std::string>& maliciousLogs, const GeneratorOptions& options);
+	//streams the log to outputfile; memory use is bounded by a few chunks per thread, not by numEvents
+	bool generateLogs(const std::string& outputfile);
+
+private:
+	static const int EVENTS_PER_CHUNK = 4096;
+
+	void generateFilename(LogRandom& rng, std::string& out) const;
+	void randomPath(LogRandom& rng, std::string& out) const;
+	void generateSource(LogRandom& rng, std::string& out) const;
+	void generateTarget(LogRandom& rng, std::string& out) const;
+	void generateEvent(LogRandom& rng, std::string& out) const;
+	void generateChunk(size_t chunk, std::string& out) const;
+
+	const std::vector<std::string>& m_goodSources;
+	const std::vector<std::string>& m_maliciousLogs;
+	GeneratorOptions m_options;
+	Popularity m_sources, m_machines;
+	std::vector<bool> m_isUrl;
+	std::vector<int> m_nextUrl; //m_nextUrl[r] is the first URL source at or after r (wrapping), or -1 if there are none
+	std::vector<int> m_maliciousEvents; //m_maliciousEvents[j] is the event that malicious line j is written before (sorted)
+};
+
+#endif // LOGGENERATOR_H_